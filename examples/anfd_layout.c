@@ -0,0 +1,169 @@
+/*
+ * Compares the cost of the fd table accesses made per event by libev's epoll
+ * backend (epoll_poll, fd_event) and per changed fd by fd_reify, with ANFD
+ * laid out as an array of 16 byte structs (as in ev.c), and as a struct of
+ * arrays, for a large number of fds.
+ *
+ * Usage: cc -O2 -o anfd_layout examples/anfd_layout.c && ./anfd_layout [fds] [rounds]
+ *
+ * Ready fds are visited in random order, as with many mostly idle
+ * connections, so that the fd table does not fit in cache and each access to
+ * a new fd misses. Watchers are allocated separately and visited in the same
+ * order in both layouts.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* ev_io, as far as fd_event and fd_reify are concerned */
+typedef struct watcher {
+  int active, pending, priority;
+  void *data, *cb;
+  struct watcher *next;
+  int fd, events;
+} watcher;
+
+/* ANFD as in ev.c (64 bit, epoll) */
+typedef struct {
+  watcher *head;
+  unsigned char events, reify, emask, eflags;
+  unsigned int egen;
+} anfd_aos;
+
+/* the same fields as separate arrays */
+typedef struct {
+  watcher **head;
+  unsigned char *events, *reify, *emask, *eflags;
+  unsigned int *egen;
+} anfd_soa;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned rand_state = 1;
+static unsigned next_rand(void) {
+  rand_state = rand_state * 1103515245 + 12345;
+  return rand_state >> 1;
+}
+
+static void shuffle(int *a, int n) {
+  for (int i = n - 1; i > 0; i--) {
+    int j = ((uint64_t)next_rand() << 16 ^ next_rand()) % (i + 1);
+    int t = a[i]; a[i] = a[j]; a[j] = t;
+  }
+}
+
+static volatile unsigned long sink;
+
+/* epoll_poll: generation check, wanted events, then fd_event */
+static unsigned long dispatch_aos(anfd_aos *t, const int *fds, const unsigned *gens, int n) {
+  unsigned long fed = 0;
+  for (int i = 0; i < n; i++) {
+    anfd_aos *a = t + fds[i];
+    if (a->egen != gens[i]) continue;
+    int got = 1, want = a->events;
+    if (got & ~want) a->emask = want;
+    if (!a->reify)
+      for (watcher *w = a->head; w; w = w->next)
+        if (w->events & got) fed++;
+  }
+  return fed;
+}
+
+static unsigned long dispatch_soa(anfd_soa *t, const int *fds, const unsigned *gens, int n) {
+  unsigned long fed = 0;
+  for (int i = 0; i < n; i++) {
+    int fd = fds[i];
+    if (t->egen[fd] != gens[i]) continue;
+    int got = 1, want = t->events[fd];
+    if (got & ~want) t->emask[fd] = want;
+    if (!t->reify[fd])
+      for (watcher *w = t->head[fd]; w; w = w->next)
+        if (w->events & got) fed++;
+  }
+  return fed;
+}
+
+/* fd_reify, with every fd changed, followed by epoll_modify */
+static void reify_aos(anfd_aos *t, const int *fds, int n) {
+  for (int i = 0; i < n; i++) {
+    anfd_aos *a = t + fds[i];
+    a->reify = 0;
+    a->events = 0;
+    for (watcher *w = a->head; w; w = w->next) a->events |= w->events;
+    a->emask = a->events;
+    ++a->egen;
+  }
+}
+
+static void reify_soa(anfd_soa *t, const int *fds, int n) {
+  for (int i = 0; i < n; i++) {
+    int fd = fds[i];
+    t->reify[fd] = 0;
+    t->events[fd] = 0;
+    for (watcher *w = t->head[fd]; w; w = w->next) t->events[fd] |= w->events;
+    t->emask[fd] = t->events[fd];
+    ++t->egen[fd];
+  }
+}
+
+int main(int argc, char **argv) {
+  int n = argc > 1 ? atoi(argv[1]) : 1000000;
+  int rounds = argc > 2 ? atoi(argv[2]) : 10;
+
+  /* watchers are allocated in random order relative to their fd */
+  int *order = malloc(n * sizeof(int));
+  for (int i = 0; i < n; i++) order[i] = i;
+  shuffle(order, n);
+  watcher *watchers = calloc(n, sizeof(watcher));
+
+  anfd_aos *aos = calloc(n, sizeof(anfd_aos));
+  anfd_soa soa = {
+    calloc(n, sizeof(watcher *)), calloc(n, 1), calloc(n, 1), calloc(n, 1), calloc(n, 1),
+    calloc(n, sizeof(unsigned int))
+  };
+  for (int fd = 0; fd < n; fd++) {
+    watcher *w = watchers + order[fd];
+    w->fd = fd;
+    w->events = 1;
+    aos[fd].head = soa.head[fd] = w;
+    aos[fd].events = soa.events[fd] = 1;
+  }
+
+  int *fds = malloc(n * sizeof(int));
+  unsigned *gens = calloc(n, sizeof(unsigned));
+  for (int i = 0; i < n; i++) fds[i] = i;
+
+  printf("%d fds, ANFD %zu bytes\n", n, sizeof(anfd_aos));
+  uint64_t t_aos = 0, t_soa = 0, r_aos = 0, r_soa = 0;
+  for (int r = 0; r < rounds; r++) {
+    shuffle(fds, n);
+    uint64_t t0 = now_ns();
+    reify_aos(aos, fds, n);
+    uint64_t t1 = now_ns();
+    reify_soa(&soa, fds, n);
+    uint64_t t2 = now_ns();
+    r_aos += t1 - t0;
+    r_soa += t2 - t1;
+
+    shuffle(fds, n);
+    for (int i = 0; i < n; i++) gens[i] = aos[fds[i]].egen;
+    t0 = now_ns();
+    sink += dispatch_aos(aos, fds, gens, n);
+    t1 = now_ns();
+    sink += dispatch_soa(&soa, fds, gens, n);
+    t2 = now_ns();
+    t_aos += t1 - t0;
+    t_soa += t2 - t1;
+  }
+
+  double events = (double)n * rounds;
+  printf("dispatch  aos %6.1f ns/event   soa %6.1f ns/event\n", t_aos / events, t_soa / events);
+  printf("reify     aos %6.1f ns/fd      soa %6.1f ns/fd\n", r_aos / events, r_soa / events);
+  return 0;
+}
@@ -0,0 +1,40 @@
+require 'bundler/setup'
+require 'libev_scheduler'
+require 'socket'
+
+# Measures the throughput of dispatching readiness events across many fds.
+# Usage: ruby examples/fd_dispatch.rb [pairs] [rounds]
+
+PAIRS = (ARGV[0] || 8000).to_i
+ROUNDS = (ARGV[1] || 20).to_i
+
+limit = Process.getrlimit(:NOFILE)[1]
+Process.setrlimit(:NOFILE, [limit, PAIRS * 2 + 64].min)
+
+pairs = PAIRS.times.map { UNIXSocket.pair }
+scheduler = Libev::Scheduler.new(expected_fds: PAIRS * 2 + 64)
+Fiber.set_scheduler scheduler
+
+received = 0
+GC.disable if ENV["NOGC"]
+pairs.each do |i, _o|
+  Fiber.schedule do
+    ROUNDS.times do
+      i.wait_readable
+      i.read_nonblock(1)
+      received += 1
+    end
+  end
+end
+
+Fiber.schedule do
+  t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  ROUNDS.times do |round|
+    pairs.each { |_i, o| o.write_nonblock('.') }
+    sleep 0 while received < PAIRS * (round + 1)
+  end
+  elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+  events = PAIRS * ROUNDS
+  puts format('%d events across %d fds in %.3fs (%.0f events/s)', events, PAIRS, elapsed, events / elapsed)
+  p scheduler.latency_stats[:poll]
+end
@@ -0,0 +1,46 @@
+require 'bundler/setup'
+require 'libev_scheduler'
+
+# Measures the per-wait overhead of the scheduler's hot waits: cooperative
+# yields, zero and non-zero sleeps, and unblocked Queue#pop calls.
+# Usage: ruby examples/wait_overhead.rb [iterations]
+
+ITERATIONS = (ARGV[0] || 1_000_000).to_i
+FIBERS = 10
+
+def measure(label, count)
+  t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  yield
+  elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+  puts format('%-12s %8.1f ns/wait', label, elapsed * 1e9 / count)
+end
+
+def run_fibers(count)
+  Thread.new do
+    scheduler = Libev::Scheduler.new
+    Fiber.set_scheduler scheduler
+    FIBERS.times { Fiber.schedule { yield scheduler, count / FIBERS } }
+  end.join
+end
+
+measure('yield', ITERATIONS) do
+  run_fibers(ITERATIONS) { |s, n| n.times { s.yield } }
+end
+
+measure('sleep(0)', ITERATIONS) do
+  run_fibers(ITERATIONS) { |_s, n| n.times { sleep 0 } }
+end
+
+measure('sleep(1e-6)', ITERATIONS / 10) do
+  run_fibers(ITERATIONS / 10) { |_s, n| n.times { sleep 0.000001 } }
+end
+
+measure('queue pop', ITERATIONS) do
+  Thread.new do
+    scheduler = Libev::Scheduler.new
+    Fiber.set_scheduler scheduler
+    queue = Thread::Queue.new
+    Fiber.schedule { ITERATIONS.times { queue.pop } }
+    Fiber.schedule { ITERATIONS.times { queue << 1; scheduler.yield } }
+  end.join
+end
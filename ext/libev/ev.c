@@ -2101,6 +2101,16 @@ typedef struct
 #endif
 } ANFD;
 
+/* fd_event, fd_reify and the backend poll functions only touch a single ANFD
+ * per fd, with the hot fields (head, events, reify) first. On 64 bit builds,
+ * an ANFD is kept at 16 bytes, so four entries share a cache line, and as the
+ * table is at least 16 byte aligned, no entry ever straddles two lines. A
+ * struct-of-arrays layout would instead touch one line per field, and is
+ * slower with large fd tables (see examples/anfd_layout.c). */
+#if EV_USE_EPOLL && !EV_SELECT_IS_WINSOCKET && !EV_USE_IOCP && __SIZEOF_POINTER__ == 8
+typedef char ev_anfd_size_check [sizeof (ANFD) == 16 ? 1 : -1];
+#endif
+
 /* stores the pending event set for a given watcher */
 typedef struct
 {
@@ -2172,6 +2182,14 @@ typedef struct
 # define EV_INVOKE_PENDING ev_invoke_pending (EV_A)
 #endif
 
+/* static tracepoints around backend polls, can be defined by the embedder */
+#ifndef EV_PROBE_BACKEND_POLL_ENTRY
+# define EV_PROBE_BACKEND_POLL_ENTRY(timeout) (void)0
+#endif
+#ifndef EV_PROBE_BACKEND_POLL_RETURN
+# define EV_PROBE_BACKEND_POLL_RETURN(res) (void)0
+#endif
+
 #define EVBREAK_RECURSE 0x80
 
 /*****************************************************************************/
@@ -4414,7 +4432,7 @@ ev_io_start (EV_P_ ev_io *w) EV_NOEXCEPT
     return;
 
   assert (("libev: ev_io_start called with negative fd", fd >= 0));
-  assert (("libev: ev_io_start called with illegal event mask", !(w->events & ~(EV__IOFDSET | EV_READ | EV_WRITE))));
+  assert (("libev: ev_io_start called with illegal event mask", !(w->events & ~(EV__IOFDSET | EV_READ | EV_WRITE | EV_ET))));
 
 #if EV_VERIFY >= 2
   assert (("libev: ev_io_start called on watcher with invalid fd", fd_valid (fd)));
@@ -91,7 +91,8 @@ epoll_modify (EV_P_ int fd, int oev, int nev)
   ev.data.u64 = (uint64_t)(uint32_t)fd
               | ((uint64_t)(uint32_t)++anfds [fd].egen << 32);
   ev.events   = (nev & EV_READ  ? EPOLLIN  : 0)
-              | (nev & EV_WRITE ? EPOLLOUT : 0);
+              | (nev & EV_WRITE ? EPOLLOUT : 0)
+              | (nev & EV_ET    ? EPOLLET  : 0);
 
   if (ecb_expect_true (!epoll_ctl (backend_fd, oev && oldmask != nev ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev)))
     return;
@@ -151,9 +152,11 @@ epoll_poll (EV_P_ ev_tstamp timeout)
 
   /* epoll wait times cannot be larger than (LONG_MAX - 999UL) / HZ msecs, which is below */
   /* the default libev max wait time, however. */
+  EV_PROBE_BACKEND_POLL_ENTRY (timeout);
   EV_RELEASE_CB;
   eventcnt = epoll_wait (backend_fd, epoll_events, epoll_eventmax, EV_TS_TO_MSEC (timeout));
   EV_ACQUIRE_CB;
+  EV_PROBE_BACKEND_POLL_RETURN (eventcnt);
 
   if (ecb_expect_false (eventcnt < 0))
     {
@@ -168,9 +171,19 @@ epoll_poll (EV_P_ ev_tstamp timeout)
       struct epoll_event *ev = epoll_events + i;
 
       int fd = (uint32_t)ev->data.u64; /* mask out the lower 32 bits */
-      int want = anfds [fd].events;
-      int got  = (ev->events & (EPOLLOUT | EPOLLERR | EPOLLHUP) ? EV_WRITE : 0)
-               | (ev->events & (EPOLLIN  | EPOLLERR | EPOLLHUP) ? EV_READ  : 0);
+      int want;
+      int got;
+
+      /* stale registration of an fd dropped from anfds by ev_loop_shrink */
+      if (ecb_expect_false (fd >= anfdmax))
+        {
+          epoll_ctl (backend_fd, EPOLL_CTL_DEL, fd, 0);
+          continue;
+        }
+
+      want = anfds [fd].events;
+      got  = (ev->events & (EPOLLOUT | EPOLLERR | EPOLLHUP) ? EV_WRITE : 0)
+           | (ev->events & (EPOLLIN  | EPOLLERR | EPOLLHUP) ? EV_READ  : 0);
 
       /*
        * check for spurious notification.
@@ -201,7 +214,8 @@ epoll_poll (EV_P_ ev_tstamp timeout)
            * to EV_READ or EV_WRITE, we might issue redundant EPOLL_CTL_MOD calls.
            */
           ev->events = (want & EV_READ  ? EPOLLIN  : 0)
-                     | (want & EV_WRITE ? EPOLLOUT : 0);
+                     | (want & EV_WRITE ? EPOLLOUT : 0)
+                     | (want & EV_ET    ? EPOLLET  : 0);
 
           /* pre-2.6.9 kernels require a non-null pointer with EPOLL_CTL_DEL, */
           /* which is fortunately easy to do for us. */
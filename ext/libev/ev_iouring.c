@@ -189,6 +189,16 @@ struct iouring_kernel_timespec
 #define IORING_TIMEOUT_ABS 0x00000001
 
 #define IORING_ENTER_GETEVENTS 0x01
+#define IORING_ENTER_EXT_ARG   0x08
+
+/* passed to io_uring_enter with IORING_ENTER_EXT_ARG */
+struct iouring_getevents_arg
+{
+  __u64 sigmask;
+  __u32 sigmask_sz;
+  __u32 pad;
+  __u64 ts;
+};
 
 #define IORING_OFF_SQ_RING 0x00000000ULL
 #define IORING_OFF_CQ_RING 0x08000000ULL
@@ -197,6 +207,7 @@ struct iouring_kernel_timespec
 #define IORING_FEAT_SINGLE_MMAP   0x00000001
 #define IORING_FEAT_NODROP        0x00000002
 #define IORING_FEAT_SUBMIT_STABLE 0x00000004
+#define IORING_FEAT_EXT_ARG       0x00000100
 
 inline_size
 int
@@ -232,16 +243,36 @@ iouring_enter (EV_P_ ev_tstamp timeout)
 {
   int res;
 
+  EV_PROBE_BACKEND_POLL_ENTRY (timeout);
   EV_RELEASE_CB;
 
-  res = evsys_io_uring_enter (iouring_fd, iouring_to_submit, 1,
-                              timeout > EV_TS_CONST (0.) ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+  if (iouring_ext_arg && timeout > EV_TS_CONST (0.))
+    {
+      /* the kernel enforces the timeout, no need for the timerfd */
+      struct iouring_kernel_timespec ts;
+      struct iouring_getevents_arg arg = { 0 };
+
+      EV_TS_SET (ts, timeout);
+      arg.ts = (__u64)(uintptr_t)&ts;
+
+      res = evsys_io_uring_enter (iouring_fd, iouring_to_submit, 1,
+                                  IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                                  (const sigset_t *)&arg, sizeof (arg));
+
+      /* ETIME just means the timeout expired, sqes have been consumed */
+      if (res < 0 && errno == ETIME)
+        res = iouring_to_submit;
+    }
+  else
+    res = evsys_io_uring_enter (iouring_fd, iouring_to_submit, 1,
+                                timeout > EV_TS_CONST (0.) ? IORING_ENTER_GETEVENTS : 0, 0, 0);
 
   assert (("libev: io_uring_enter did not consume all sqes", (res < 0 || res == iouring_to_submit)));
 
   iouring_to_submit = 0;
 
   EV_ACQUIRE_CB;
+  EV_PROBE_BACKEND_POLL_RETURN (res);
 
   return res;
 }
@@ -316,7 +347,8 @@ ecb_cold
 static int
 iouring_internal_destroy (EV_P)
 {
-  close (iouring_tfd);
+  if (iouring_tfd >= 0)
+    close (iouring_tfd);
   close (iouring_fd);
 
   if (iouring_sq_ring != MAP_FAILED) munmap (iouring_sq_ring, iouring_sq_ring_size);
@@ -403,6 +435,12 @@ iouring_internal_init (EV_P)
   iouring_cq_overflow     = params.cq_off.overflow;
   iouring_cq_cqes         = params.cq_off.cqes;
 
+  /* kernels supporting extended arguments (5.11+) take the timeout directly,
+   * otherwise a timerfd is used for waking up */
+  iouring_ext_arg = !!(params.features & IORING_FEAT_EXT_ARG);
+  if (iouring_ext_arg)
+    return 0;
+
   iouring_tfd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC);
 
   if (iouring_tfd < 0)
@@ -424,9 +462,12 @@ iouring_fork (EV_P)
 
   fd_rearm_all (EV_A);
 
-  ev_io_stop  (EV_A_ &iouring_tfd_w);
-  ev_io_set   (EV_A_ &iouring_tfd_w, iouring_tfd, EV_READ);
-  ev_io_start (EV_A_ &iouring_tfd_w);
+  if (iouring_tfd >= 0)
+    {
+      ev_io_stop  (EV_A_ &iouring_tfd_w);
+      ev_io_set   (EV_A_ &iouring_tfd_w, iouring_tfd, EV_READ);
+      ev_io_start (EV_A_ &iouring_tfd_w);
+    }
 }
 
 /*****************************************************************************/
@@ -502,7 +543,11 @@ iouring_process_cqe (EV_P_ struct io_uring_cqe *cqe)
   if (cqe->user_data == (uint64_t)-1)
     return;
 
-  assert (("libev: io_uring fd must be in-bounds", fd >= 0 && fd < anfdmax));
+  assert (("libev: io_uring fd must be in-bounds", fd >= 0));
+
+  /* stale completion for an fd dropped from anfds by ev_loop_shrink */
+  if (ecb_expect_false (fd >= anfdmax))
+    return;
 
   /* documentation lies, of course. the result value is NOT like
    * normal syscalls, but like linux raw syscalls, i.e. negative
@@ -640,7 +685,7 @@ iouring_poll (EV_P_ ev_tstamp timeout)
   /* TODO: fdchacngecnt is always 0 because fd_reify does not have two buffers yet */
   if (iouring_handle_cq (EV_A) || fdchangecnt)
     timeout = EV_TS_CONST (0.);
-  else
+  else if (!iouring_ext_arg)
     /* no events, so maybe wait for some */
     iouring_tfd_update (EV_A_ timeout);
 
@@ -675,9 +720,12 @@ iouring_init (EV_P_ int flags)
     }
 
   ev_io_init  (&iouring_tfd_w, iouring_tfd_cb, iouring_tfd, EV_READ);
-  ev_set_priority (&iouring_tfd_w, EV_MINPRI);
-  ev_io_start (EV_A_ &iouring_tfd_w);
-  ev_unref (EV_A); /* watcher should not keep loop alive */
+  if (iouring_tfd >= 0)
+    {
+      ev_set_priority (&iouring_tfd_w, EV_MINPRI);
+      ev_io_start (EV_A_ &iouring_tfd_w);
+      ev_unref (EV_A); /* watcher should not keep loop alive */
+    }
 
   backend_modify = iouring_modify;
   backend_poll   = iouring_poll;
@@ -97,10 +97,12 @@ kqueue_poll (EV_P_ ev_tstamp timeout)
       kqueue_events = (struct kevent *)ev_malloc (sizeof (struct kevent) * kqueue_eventmax);
     }
 
+  EV_PROBE_BACKEND_POLL_ENTRY (timeout);
   EV_RELEASE_CB;
   EV_TS_SET (ts, timeout);
   res = kevent (backend_fd, kqueue_changes, kqueue_changecnt, kqueue_events, kqueue_eventmax, &ts);
   EV_ACQUIRE_CB;
+  EV_PROBE_BACKEND_POLL_RETURN (res);
   kqueue_changecnt = 0;
 
   if (ecb_expect_false (res < 0))
@@ -309,10 +309,11 @@ linuxaio_parse_events (EV_P_ struct io_event *ev, int nr)
       uint32_t gen = ev->data >> 32;
       int res      = ev->res;
 
-      assert (("libev: iocb fd must be in-bounds", fd >= 0 && fd < anfdmax));
+      assert (("libev: iocb fd must be in-bounds", fd >= 0));
 
       /* only accept events if generation counter matches */
-      if (ecb_expect_true (gen == (uint32_t)anfds [fd].egen))
+      /* (fds beyond anfdmax were dropped by ev_loop_shrink) */
+      if (ecb_expect_true (fd < anfdmax && gen == (uint32_t)anfds [fd].egen))
         {
           /* feed events, we do not expect or handle POLLNVAL */
           fd_event (
@@ -406,12 +407,14 @@ linuxaio_get_events (EV_P_ ev_tstamp timeout)
     {
       int res;
 
+      EV_PROBE_BACKEND_POLL_ENTRY (timeout);
       EV_RELEASE_CB;
 
       EV_TS_SET (ts, timeout);
       res = evsys_io_getevents (linuxaio_ctx, 1, want, ioev, &ts);
 
       EV_ACQUIRE_CB;
+      EV_PROBE_BACKEND_POLL_RETURN (res);
 
       if (res < 0)
         if (errno == EINTR)
@@ -94,9 +94,11 @@ poll_poll (EV_P_ ev_tstamp timeout)
   struct pollfd *p;
   int res;
   
+  EV_PROBE_BACKEND_POLL_ENTRY (timeout);
   EV_RELEASE_CB;
   res = poll (polls, pollcnt, EV_TS_TO_MSEC (timeout));
   EV_ACQUIRE_CB;
+  EV_PROBE_BACKEND_POLL_RETURN (res);
 
   if (ecb_expect_false (res < 0))
     {
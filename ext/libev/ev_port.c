@@ -105,10 +105,12 @@ port_poll (EV_P_ ev_tstamp timeout)
   /* whether it was the original value or has been updated :/ */
   port_events [0].portev_source = 0;
 
+  EV_PROBE_BACKEND_POLL_ENTRY (timeout);
   EV_RELEASE_CB;
   EV_TS_SET (ts, timeout);
   res = port_getn (backend_fd, port_events, port_eventmax, &nget, &ts);
   EV_ACQUIRE_CB;
+  EV_PROBE_BACKEND_POLL_RETURN (res);
 
   /* port_getn may or may not set nget on error */
   /* so we rely on port_events [0].portev_source not being updated */
@@ -143,6 +143,7 @@ select_poll (EV_P_ ev_tstamp timeout)
   int res;
   int fd_setsize;
 
+  EV_PROBE_BACKEND_POLL_ENTRY (timeout);
   EV_RELEASE_CB;
   EV_TV_SET (tv, timeout);
 
@@ -170,6 +171,7 @@ select_poll (EV_P_ ev_tstamp timeout)
   res = select (vec_max * NFDBITS, (fd_set *)vec_ro, (fd_set *)vec_wo, 0, &tv);
 #endif
   EV_ACQUIRE_CB;
+  EV_PROBE_BACKEND_POLL_RETURN (res);
 
   if (ecb_expect_false (res < 0))
     {
@@ -0,0 +1,158 @@
+#include "scheduler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Allocator for libev's internal arrays (anfds, pendings, timers, fdchanges
+// etc). Memory is allocated outside of Ruby's heap accounting, so that growing
+// the loop's arrays during a connection storm does not trigger a GC. Each
+// block is prefixed with a small header recording its size, which is used for
+// keeping stats. Large blocks can optionally be mapped directly and advised to
+// be backed by transparent huge pages.
+
+#define HUGEPAGE_THRESHOLD (2 * 1024 * 1024)
+
+typedef struct alloc_header {
+  size_t size;   // usable size
+  size_t mapped; // mapping length if mmapped, otherwise 0
+} alloc_header;
+
+static struct {
+  size_t allocated;  // bytes currently allocated
+  size_t peak;       // max bytes allocated
+  size_t blocks;     // blocks currently allocated
+  size_t mapped;     // bytes currently in hugepage mappings
+  size_t reallocs;   // total calls resulting in an allocation or resize
+} stats;
+
+static int use_hugepages = 0;
+
+// Exported by Ruby, but not declared in its public headers
+int ruby_thread_has_gvl_p(void);
+
+// Allocations may happen concurrently on loops running in different threads
+#define STAT_ADD(field, value) __atomic_add_fetch(&stats.field, (value), __ATOMIC_RELAXED)
+#define STAT_SUB(field, value) __atomic_sub_fetch(&stats.field, (value), __ATOMIC_RELAXED)
+
+static void stats_update_peak(size_t allocated) {
+  size_t peak = __atomic_load_n(&stats.peak, __ATOMIC_RELAXED);
+  while (allocated > peak &&
+    !__atomic_compare_exchange_n(&stats.peak, &peak, allocated, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static alloc_header *block_map(size_t size) {
+  size_t len = (sizeof(alloc_header) + size + HUGEPAGE_THRESHOLD - 1) & ~((size_t)HUGEPAGE_THRESHOLD - 1);
+  void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+  madvise(addr, len, MADV_HUGEPAGE);
+#endif
+  alloc_header *header = addr;
+  header->mapped = len;
+  STAT_ADD(mapped, len);
+  return header;
+}
+
+static void block_free(alloc_header *header) {
+  if (header->mapped) {
+    STAT_SUB(mapped, header->mapped);
+    munmap(header, header->mapped);
+  }
+  else
+    free(header);
+}
+
+static alloc_header *block_resize(alloc_header *header, size_t size) {
+  int map = use_hugepages && size >= HUGEPAGE_THRESHOLD;
+
+  if (!header) {
+    if (map) return block_map(size);
+    header = malloc(sizeof(alloc_header) + size);
+    if (header) header->mapped = 0;
+    return header;
+  }
+
+  if (!map && !header->mapped) {
+    alloc_header *resized = realloc(header, sizeof(alloc_header) + size);
+    if (resized) resized->mapped = 0;
+    return resized;
+  }
+
+  if (header->mapped && sizeof(alloc_header) + size <= header->mapped && map)
+    return header; // still fits in the existing mapping
+
+  // move between heap and mapping, or to a larger mapping
+  alloc_header *resized = map ? block_map(size) : malloc(sizeof(alloc_header) + size);
+  if (!resized) return NULL;
+  if (!map) resized->mapped = 0;
+  memcpy(resized + 1, header + 1, header->size < size ? header->size : size);
+  block_free(header);
+  return resized;
+}
+
+// realloc-compatible callback passed to ev_set_allocator
+static void *libev_realloc(void *ptr, size_t size) EV_NOEXCEPT {
+  alloc_header *header = ptr ? (alloc_header *)ptr - 1 : NULL;
+  size_t old_size = header ? header->size : 0;
+
+  if (!size) {
+    if (header) {
+      STAT_SUB(allocated, old_size);
+      STAT_SUB(blocks, 1);
+      block_free(header);
+    }
+    return NULL;
+  }
+
+  alloc_header *resized = block_resize(header, size);
+  if (!resized && ruby_thread_has_gvl_p()) {
+    // as with xrealloc, collect garbage and retry once, then raise
+    // NoMemoryError. Without the GVL (e.g. while polling), libev aborts.
+    rb_gc();
+    resized = block_resize(header, size);
+    if (!resized) rb_memerror();
+  }
+  if (!resized) return NULL;
+
+  resized->size = size;
+  STAT_ADD(reallocs, 1);
+  if (!header) STAT_ADD(blocks, 1);
+  if (size > old_size)
+    stats_update_peak(STAT_ADD(allocated, size - old_size));
+  else
+    STAT_SUB(allocated, old_size - size);
+  return resized + 1;
+}
+
+// Returns stats for memory allocated by libev for all loops
+VALUE Scheduler_s_allocator_stats(VALUE self) {
+  VALUE hash = rb_hash_new();
+  rb_hash_aset(hash, ID2SYM(rb_intern("allocated")), SIZET2NUM(__atomic_load_n(&stats.allocated, __ATOMIC_RELAXED)));
+  rb_hash_aset(hash, ID2SYM(rb_intern("peak")), SIZET2NUM(__atomic_load_n(&stats.peak, __ATOMIC_RELAXED)));
+  rb_hash_aset(hash, ID2SYM(rb_intern("blocks")), SIZET2NUM(__atomic_load_n(&stats.blocks, __ATOMIC_RELAXED)));
+  rb_hash_aset(hash, ID2SYM(rb_intern("hugepage_mapped")), SIZET2NUM(__atomic_load_n(&stats.mapped, __ATOMIC_RELAXED)));
+  rb_hash_aset(hash, ID2SYM(rb_intern("reallocs")), SIZET2NUM(__atomic_load_n(&stats.reallocs, __ATOMIC_RELAXED)));
+  return hash;
+}
+
+// Enables or disables mapping large blocks (2MB and up) with hugepage advice.
+// Only affects blocks allocated or resized after the call.
+VALUE Scheduler_s_set_hugepages(VALUE self, VALUE enabled) {
+  use_hugepages = RTEST(enabled);
+  return enabled;
+}
+
+VALUE Scheduler_s_hugepages_p(VALUE self) {
+  return use_hugepages ? Qtrue : Qfalse;
+}
+
+void Init_Allocator(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  VALUE cScheduler = rb_const_get(mLibev, rb_intern("Scheduler"));
+
+  ev_set_allocator(libev_realloc);
+
+  rb_define_singleton_method(cScheduler, "allocator_stats", Scheduler_s_allocator_stats, 0);
+  rb_define_singleton_method(cScheduler, "hugepages=", Scheduler_s_set_hugepages, 1);
+  rb_define_singleton_method(cScheduler, "hugepages?", Scheduler_s_hugepages_p, 0);
+}
@@ -0,0 +1,225 @@
+#include "scheduler.h"
+#include "ruby/fiber/scheduler.h"
+
+// Cancellation scopes. A fiber running a block with CancelScope#run is linked
+// into the scope's member list for the duration of the block (the member record
+// lives on the fiber's stack). Cancelling the scope walks the list once, and
+// schedules each member fiber with the scope's Libev::Cancelled error as its
+// resume value, so the fiber raises it from whatever it is waiting on, after
+// stopping its watchers. A fiber that is not waiting gets the error at its next
+// wait. The error unwinds to the scope's run, which returns nil.
+//
+// Scopes nest: a fiber running in nested scopes is a member of each, and an
+// error raised by an outer scope passes through the inner ones. A scope can
+// also be given a timeout, in which case it is cancelled by a timer started
+// when the first fiber enters it.
+
+struct cancel_member {
+  struct cancel_member *prev;
+  struct cancel_member *next;
+  Scheduler_t *scheduler;
+  VALUE fiber;
+  int pending; // cancellation scheduled but not yet raised
+};
+
+typedef struct CancelScope_t {
+  struct cancel_member *head;
+  struct cancel_member *tail;
+  VALUE error; // raised in members once cancelled
+  int cancelled;
+  int timed_out;
+  uint64_t deadline; // monotonic time (ns), 0 if no timeout
+  struct ev_timer timer;
+  Scheduler_t *timer_scheduler; // scheduler running the timer while active
+} CancelScope_t;
+
+static VALUE cCancelScope;
+static VALUE eCancelled;
+
+static void CancelScope_mark(void *ptr) {
+  CancelScope_t *scope = ptr;
+  rb_gc_mark(scope->error);
+  for (struct cancel_member *member = scope->head; member; member = member->next)
+    rb_gc_mark(member->fiber);
+}
+
+static size_t CancelScope_size(const void *ptr) {
+  return sizeof(CancelScope_t);
+}
+
+static const rb_data_type_t CancelScope_type = {
+    "LibevCancelScope",
+    {CancelScope_mark, RUBY_TYPED_DEFAULT_FREE, CancelScope_size,},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+#define GetCancelScope(obj, scope) \
+  TypedData_Get_Struct((obj), CancelScope_t, &CancelScope_type, (scope))
+
+static void cancel_scope_timer_callback(EV_P_ ev_timer *w, int revents);
+
+static VALUE CancelScope_allocate(VALUE klass) {
+  CancelScope_t *scope = ALLOC(CancelScope_t);
+  scope->head = NULL;
+  scope->tail = NULL;
+  scope->error = Qnil;
+  scope->cancelled = 0;
+  scope->timed_out = 0;
+  scope->deadline = 0;
+  ev_timer_init(&scope->timer, cancel_scope_timer_callback, 0., 0.);
+  scope->timer_scheduler = NULL;
+
+  return TypedData_Wrap_Struct(klass, &CancelScope_type, scope);
+}
+
+// Initializes a scope. If a timeout (in seconds) is given, the scope is
+// cancelled once it elapses, counting from now.
+static VALUE CancelScope_initialize(int argc, VALUE *argv, VALUE self) {
+  CancelScope_t *scope;
+  GetCancelScope(self, scope);
+  rb_check_arity(argc, 0, 1);
+
+  if (argc == 1 && !NIL_P(argv[0])) {
+    double timeout = NUM2DBL(argv[0]);
+    if (timeout < 0) timeout = 0;
+    scope->deadline = monotonic_ns() + (uint64_t)(timeout * 1e9);
+    if (!scope->deadline) scope->deadline = 1;
+  }
+  return self;
+}
+
+static void cancel_scope_timer_stop(CancelScope_t *scope) {
+  if (ev_is_active(&scope->timer))
+    ev_timer_stop(scope->timer_scheduler->ev_loop, &scope->timer);
+}
+
+// Marks the scope as cancelled and schedules all member fibers, except the
+// current one, with the cancellation error. Returns true if the current fiber
+// is a member.
+static int cancel_scope_cancel(CancelScope_t *scope, int timed_out) {
+  if (scope->cancelled) return 0;
+
+  scope->cancelled = 1;
+  scope->timed_out = timed_out;
+  scope->error = rb_exc_new_cstr(eCancelled, timed_out ? "timed out" : "cancelled");
+  cancel_scope_timer_stop(scope);
+
+  VALUE current = rb_fiber_current();
+  int cancel_current = 0;
+  for (struct cancel_member *member = scope->head; member; member = member->next) {
+    if (member->fiber == current) {
+      cancel_current = 1;
+      continue;
+    }
+    member->pending = 1;
+    SCHEDULE_VALUE(member->scheduler, member->fiber, scope->error);
+    if (member->scheduler->currently_polling)
+      ev_async_send(member->scheduler->ev_loop, &member->scheduler->break_async);
+  }
+  return cancel_current;
+}
+
+static void cancel_scope_timer_callback(EV_P_ ev_timer *w, int revents) {
+  CancelScope_t *scope = (CancelScope_t *)((char *)w - offsetof(CancelScope_t, timer));
+  cancel_scope_cancel(scope, 1);
+}
+
+static void cancel_scope_timer_start(CancelScope_t *scope, Scheduler_t *scheduler) {
+  uint64_t now = monotonic_ns();
+  double remaining = scope->deadline > now ? (scope->deadline - now) / 1e9 : 0;
+  ev_timer_set(&scope->timer, remaining, 0.);
+  ev_timer_start(scheduler->ev_loop, &scope->timer);
+  scope->timer_scheduler = scheduler;
+}
+
+static void cancel_scope_remove(CancelScope_t *scope, struct cancel_member *member) {
+  if (member->prev) member->prev->next = member->next; else scope->head = member->next;
+  if (member->next) member->next->prev = member->prev; else scope->tail = member->prev;
+  if (!scope->head) cancel_scope_timer_stop(scope);
+}
+
+// Runs the given block as a member of the scope. Returns the block's value, or
+// nil if the scope was cancelled (or is already cancelled). Must be called from
+// a fiber running on a Libev scheduler.
+static VALUE CancelScope_run(VALUE self) {
+  CancelScope_t *scope;
+  GetCancelScope(self, scope);
+
+  Scheduler_t *scheduler = waiter_current_scheduler(rb_fiber_scheduler_current());
+  if (!scheduler) rb_raise(rb_eRuntimeError, "must be called from a fiber running on a Libev::Scheduler");
+  if (scope->cancelled) return Qnil;
+
+  struct cancel_member member = {
+    .next = NULL,
+    .prev = scope->tail,
+    .scheduler = scheduler,
+    .fiber = rb_fiber_current(),
+    .pending = 0
+  };
+  if (scope->tail) scope->tail->next = &member; else scope->head = &member;
+  scope->tail = &member;
+  if (scope->deadline && !ev_is_active(&scope->timer))
+    cancel_scope_timer_start(scope, scheduler);
+
+  int state;
+  VALUE ret = rb_protect(rb_yield, Qnil, &state);
+  cancel_scope_remove(scope, &member);
+
+  if (member.pending)
+    // not raised, as the block did not wait again before returning, or
+    // another exception unwound it first
+    runqueue_delete_value(&scheduler->runqueue, member.fiber, scope->error);
+  if (scope->cancelled)
+    // drop wakeups for waits the cancellation interrupted
+    runqueue_delete_value(&scheduler->runqueue, member.fiber, Qnil);
+
+  if (state) {
+    if (!NIL_P(scope->error) && rb_errinfo() == scope->error) {
+      rb_set_errinfo(Qnil);
+      return Qnil;
+    }
+    rb_jump_tag(state);
+  }
+  RB_GC_GUARD(member.fiber);
+  return ret;
+}
+
+// Cancels the scope. Fibers running in the scope raise Libev::Cancelled from
+// their current (or next) wait. If called from a fiber running in the scope,
+// the error is raised immediately.
+static VALUE CancelScope_cancel(VALUE self) {
+  CancelScope_t *scope;
+  GetCancelScope(self, scope);
+
+  if (cancel_scope_cancel(scope, 0)) rb_exc_raise(scope->error);
+  return self;
+}
+
+static VALUE CancelScope_cancelled_p(VALUE self) {
+  CancelScope_t *scope;
+  GetCancelScope(self, scope);
+
+  return scope->cancelled ? Qtrue : Qfalse;
+}
+
+static VALUE CancelScope_timed_out_p(VALUE self) {
+  CancelScope_t *scope;
+  GetCancelScope(self, scope);
+
+  return scope->timed_out ? Qtrue : Qfalse;
+}
+
+void Init_CancelScope(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  cCancelScope = rb_define_class_under(mLibev, "CancelScope", rb_cObject);
+  rb_define_alloc_func(cCancelScope, CancelScope_allocate);
+
+  // Not a StandardError, so it is not swallowed by a bare rescue
+  eCancelled = rb_define_class_under(mLibev, "Cancelled", rb_eException);
+
+  rb_define_method(cCancelScope, "initialize", CancelScope_initialize, -1);
+  rb_define_method(cCancelScope, "run", CancelScope_run, 0);
+  rb_define_method(cCancelScope, "cancel", CancelScope_cancel, 0);
+  rb_define_method(cCancelScope, "cancelled?", CancelScope_cancelled_p, 0);
+  rb_define_method(cCancelScope, "timed_out?", CancelScope_timed_out_p, 0);
+}
@@ -0,0 +1,236 @@
+#include "scheduler.h"
+
+// A FIFO channel for passing values between fibers. Values are kept in a ring
+// buffer, and fibers waiting to pop (or to push, on a full bounded channel) are
+// kept in waiter lists (see waiter.c). A push with a waiting popper hands the
+// value to it directly, and schedules it on its scheduler's runqueue, without
+// going through the block/unblock hooks.
+
+#define CHANNEL_INITIAL_SIZE 16
+
+typedef struct Channel_t {
+  VALUE *items;
+  unsigned int head;
+  unsigned int count;
+  unsigned int size;
+  unsigned int capacity; // 0 if unbounded
+  int closed;
+  struct waiter_list poppers;
+  struct waiter_list pushers;
+} Channel_t;
+
+static VALUE cChannel;
+static VALUE eClosedQueueError;
+
+static void Channel_mark(void *ptr) {
+  Channel_t *channel = ptr;
+  for (unsigned int i = 0; i < channel->count; i++)
+    rb_gc_mark(channel->items[(channel->head + i) % channel->size]);
+  waiter_list_mark(&channel->poppers);
+  waiter_list_mark(&channel->pushers);
+}
+
+static void Channel_free(void *ptr) {
+  Channel_t *channel = ptr;
+  xfree(channel->items);
+  xfree(channel);
+}
+
+static size_t Channel_size(const void *ptr) {
+  const Channel_t *channel = ptr;
+  return sizeof(Channel_t) + channel->size * sizeof(VALUE);
+}
+
+static const rb_data_type_t Channel_type = {
+    "LibevChannel",
+    {Channel_mark, Channel_free, Channel_size,},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+#define GetChannel(obj, channel) \
+  TypedData_Get_Struct((obj), Channel_t, &Channel_type, (channel))
+
+static VALUE Channel_allocate(VALUE klass) {
+  Channel_t *channel = ALLOC(Channel_t);
+  channel->size = CHANNEL_INITIAL_SIZE;
+  channel->items = ALLOC_N(VALUE, channel->size);
+  channel->head = 0;
+  channel->count = 0;
+  channel->capacity = 0;
+  channel->closed = 0;
+  channel->poppers = (struct waiter_list){ NULL, NULL };
+  channel->pushers = (struct waiter_list){ NULL, NULL };
+
+  return TypedData_Wrap_Struct(klass, &Channel_type, channel);
+}
+
+static void channel_items_grow(Channel_t *channel) {
+  unsigned int old_size = channel->size;
+  channel->size = old_size * 2;
+  REALLOC_N(channel->items, VALUE, channel->size);
+  // move wrapped items into the newly added space
+  if (channel->head + channel->count > old_size) {
+    unsigned int wrapped = channel->head + channel->count - old_size;
+    MEMCPY(channel->items + old_size, channel->items, VALUE, wrapped);
+  }
+}
+
+static void channel_items_push(Channel_t *channel, VALUE value) {
+  if (channel->count == channel->size) channel_items_grow(channel);
+  channel->items[(channel->head + channel->count) % channel->size] = value;
+  channel->count++;
+}
+
+static void channel_items_unshift(Channel_t *channel, VALUE value) {
+  if (channel->count == channel->size) channel_items_grow(channel);
+  channel->head = (channel->head + channel->size - 1) % channel->size;
+  channel->items[channel->head] = value;
+  channel->count++;
+}
+
+static VALUE channel_items_shift(Channel_t *channel) {
+  VALUE value = channel->items[channel->head];
+  channel->head = (channel->head + 1) % channel->size;
+  channel->count--;
+  return value;
+}
+
+// Initializes a channel. If a capacity is given, pushing to a full channel
+// waits until a value is popped.
+static VALUE Channel_initialize(int argc, VALUE *argv, VALUE self) {
+  Channel_t *channel;
+  GetChannel(self, channel);
+  rb_check_arity(argc, 0, 1);
+
+  if (argc == 1 && !NIL_P(argv[0])) {
+    int capacity = NUM2INT(argv[0]);
+    if (capacity <= 0) rb_raise(rb_eArgError, "capacity must be positive");
+    channel->capacity = capacity;
+  }
+  return self;
+}
+
+static VALUE Channel_push(VALUE self, VALUE value) {
+  Channel_t *channel;
+  GetChannel(self, channel);
+
+  if (channel->closed) rb_raise(eClosedQueueError, "channel closed");
+
+  struct waiter *popper = waiter_list_shift(&channel->poppers);
+  if (popper) {
+    popper->value = value;
+    waiter_wake(popper, WAITER_DONE);
+    return self;
+  }
+
+  if (!channel->capacity || channel->count < channel->capacity) {
+    channel_items_push(channel, value);
+    return self;
+  }
+
+  struct waiter waiter = { .blocker = self, .value = value };
+  int state;
+  VALUE ret = waiter_wait(&channel->pushers, &waiter, &state);
+  RAISE_IF_EXCEPTION(state, ret);
+  if (waiter.state == WAITER_CLOSED) rb_raise(eClosedQueueError, "channel closed");
+  RB_GC_GUARD(value);
+  return self;
+}
+
+// Returns the next value, waiting for one to be pushed if the channel is empty.
+// Returns nil if the channel is closed and empty.
+static VALUE Channel_pop(VALUE self) {
+  Channel_t *channel;
+  GetChannel(self, channel);
+
+  if (channel->count) {
+    VALUE value = channel_items_shift(channel);
+    struct waiter *pusher = waiter_list_shift(&channel->pushers);
+    if (pusher) {
+      channel_items_push(channel, pusher->value);
+      waiter_wake(pusher, WAITER_DONE);
+    }
+    return value;
+  }
+  if (channel->closed) return Qnil;
+
+  struct waiter waiter = { .blocker = self, .value = Qnil };
+  int state;
+  VALUE ret = waiter_wait(&channel->poppers, &waiter, &state);
+  if (state || RESUMED_WITH_EXCEPTION(ret)) {
+    if (waiter.state == WAITER_DONE) {
+      // don't lose a value handed over before the exception was raised
+      struct waiter *popper = waiter_list_shift(&channel->poppers);
+      if (popper) {
+        popper->value = waiter.value;
+        waiter_wake(popper, WAITER_DONE);
+      }
+      else
+        channel_items_unshift(channel, waiter.value);
+    }
+    RAISE_IF_EXCEPTION(state, ret);
+  }
+  return waiter.value;
+}
+
+// Closes the channel. Waiting poppers return nil, and waiting pushers raise
+// ClosedQueueError. Values already pushed can still be popped.
+static VALUE Channel_close(VALUE self) {
+  Channel_t *channel;
+  GetChannel(self, channel);
+
+  channel->closed = 1;
+  struct waiter *waiter;
+  while ((waiter = waiter_list_shift(&channel->poppers))) waiter_wake(waiter, WAITER_CLOSED);
+  while ((waiter = waiter_list_shift(&channel->pushers))) waiter_wake(waiter, WAITER_CLOSED);
+  return self;
+}
+
+static VALUE Channel_closed_p(VALUE self) {
+  Channel_t *channel;
+  GetChannel(self, channel);
+
+  return channel->closed ? Qtrue : Qfalse;
+}
+
+static VALUE Channel_length(VALUE self) {
+  Channel_t *channel;
+  GetChannel(self, channel);
+
+  return UINT2NUM(channel->count);
+}
+
+static VALUE Channel_empty_p(VALUE self) {
+  Channel_t *channel;
+  GetChannel(self, channel);
+
+  return channel->count ? Qfalse : Qtrue;
+}
+
+static VALUE Channel_capacity(VALUE self) {
+  Channel_t *channel;
+  GetChannel(self, channel);
+
+  return channel->capacity ? UINT2NUM(channel->capacity) : Qnil;
+}
+
+void Init_Channel(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  cChannel = rb_define_class_under(mLibev, "Channel", rb_cObject);
+  rb_define_alloc_func(cChannel, Channel_allocate);
+
+  eClosedQueueError = rb_const_get(rb_cObject, rb_intern("ClosedQueueError"));
+  rb_gc_register_mark_object(eClosedQueueError);
+
+  rb_define_method(cChannel, "initialize", Channel_initialize, -1);
+  rb_define_method(cChannel, "push", Channel_push, 1);
+  rb_define_method(cChannel, "<<", Channel_push, 1);
+  rb_define_method(cChannel, "pop", Channel_pop, 0);
+  rb_define_method(cChannel, "shift", Channel_pop, 0);
+  rb_define_method(cChannel, "close", Channel_close, 0);
+  rb_define_method(cChannel, "closed?", Channel_closed_p, 0);
+  rb_define_method(cChannel, "length", Channel_length, 0);
+  rb_define_method(cChannel, "size", Channel_length, 0);
+  rb_define_method(cChannel, "empty?", Channel_empty_p, 0);
+  rb_define_method(cChannel, "capacity", Channel_capacity, 0);
+}
@@ -0,0 +1,373 @@
+#include "scheduler.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+// Write coalescing for corked IOs. Small writes to a corked IO are appended to
+// a per-fd buffer, and all dirty buffers are flushed with a single syscall per
+// fd from an ev_prepare watcher, i.e. right before the loop polls. A write that
+// would take the buffer past its threshold is flushed immediately, together
+// with the buffered data, using writev.
+//
+// A fiber waiting for its data to be written out holds a reference to the
+// buffer, so that the buffer can be closed (by uncork, or by corking an IO
+// reusing the fd) while other fibers are still waiting on it. A closed buffer
+// is removed from the fd table and its data is released, but the struct stays
+// allocated until the last waiter has checked its outcome.
+
+#define CORK_DEFAULT_THRESHOLD 65536
+
+struct write_buffer {
+  struct ev_io io; // started when a flush from the prepare watcher hits EAGAIN
+  Scheduler_t *scheduler;
+  VALUE io_obj;
+  rb_io_t *fptr;
+  int fd;
+  char *data;
+  size_t len;
+  size_t capa;
+  size_t threshold;
+  uint64_t flushed; // total bytes written out from the buffer
+  int error; // errno of a failed background flush, reported on next write
+  int refcount; // one for the fd table, one per waiting fiber
+  int closing;
+  struct write_buffer *next_dirty;
+};
+
+static struct write_buffer *write_buffer_get(Scheduler_t *scheduler, int fd) {
+  return fd < scheduler->write_buffers_size ? scheduler->write_buffers[fd] : NULL;
+}
+
+// Appends data to the buffer. A buffer holding data is marked dirty and counts
+// as a pending operation, so the loop keeps running until the data is flushed.
+static void write_buffer_append(struct write_buffer *buffer, const char *base, size_t size) {
+  if (buffer->len + size > buffer->capa) {
+    size_t capa = buffer->capa ? buffer->capa : buffer->threshold;
+    while (capa < buffer->len + size) capa *= 2;
+    REALLOC_N(buffer->data, char, capa);
+    buffer->capa = capa;
+  }
+  memcpy(buffer->data + buffer->len, base, size);
+  if (!buffer->len && size) {
+    Scheduler_t *scheduler = buffer->scheduler;
+    buffer->next_dirty = scheduler->dirty_write_buffers;
+    scheduler->dirty_write_buffers = buffer;
+    scheduler->pending_count++;
+    ev_ref(scheduler->ev_loop);
+  }
+  buffer->len += size;
+}
+
+static void write_buffer_clear(struct write_buffer *buffer) {
+  Scheduler_t *scheduler = buffer->scheduler;
+  struct write_buffer **ptr = &scheduler->dirty_write_buffers;
+  while (*ptr && *ptr != buffer) ptr = &(*ptr)->next_dirty;
+  if (*ptr) {
+    *ptr = buffer->next_dirty;
+    scheduler->pending_count--;
+    ev_unref(scheduler->ev_loop);
+  }
+  if (ev_is_active(&buffer->io)) ev_io_stop(scheduler->ev_loop, &buffer->io);
+  buffer->len = 0;
+}
+
+static void write_buffer_consume(struct write_buffer *buffer, size_t len) {
+  memmove(buffer->data, buffer->data + len, buffer->len - len);
+  buffer->len -= len;
+  buffer->flushed += len;
+}
+
+// Attempts to write out buffered data without blocking. Returns 0 when the
+// buffer is empty, -1 on EAGAIN.
+static int write_buffer_try_flush(struct write_buffer *buffer) {
+  if (fptr_fd(buffer->fptr) != buffer->fd) {
+    // the IO was closed while corked, the data can no longer be written
+    buffer->error = EBADF;
+    write_buffer_clear(buffer);
+    return 0;
+  }
+
+  size_t written = 0;
+  while (written < buffer->len) {
+    ssize_t ret = write(buffer->fd, buffer->data + written, buffer->len - written);
+    if (ret >= 0) {
+      written += ret;
+      continue;
+    }
+    if (errno == EINTR) continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      write_buffer_consume(buffer, written);
+      return -1;
+    }
+    buffer->error = errno;
+    break;
+  }
+  buffer->flushed += written;
+  write_buffer_clear(buffer);
+  return 0;
+}
+
+static void write_buffer_io_callback(EV_P_ ev_io *w, int revents) {
+  write_buffer_try_flush((struct write_buffer *)w);
+}
+
+static void Scheduler_cork_prepare_callback(EV_P_ ev_prepare *w, int revents) {
+  Scheduler_t *scheduler = (Scheduler_t *)((char *)w - offsetof(Scheduler_t, cork_prepare));
+  struct write_buffer *buffer = scheduler->dirty_write_buffers;
+  while (buffer) {
+    struct write_buffer *next = buffer->next_dirty;
+    if (!ev_is_active(&buffer->io) && write_buffer_try_flush(buffer))
+      ev_io_start(scheduler->ev_loop, &buffer->io);
+    buffer = next;
+  }
+}
+
+static void write_buffer_unref(struct write_buffer *buffer) {
+  if (!--buffer->refcount) xfree(buffer);
+}
+
+// Removes the buffer from the fd table, dropping any unwritten data. Fibers
+// still waiting on the buffer find it closing when resumed.
+static void write_buffer_close(Scheduler_t *scheduler, struct write_buffer *buffer) {
+  if (buffer->closing) return;
+
+  write_buffer_clear(buffer);
+  buffer->closing = 1;
+  scheduler->write_buffers[buffer->fd] = NULL;
+  xfree(buffer->data);
+  buffer->data = NULL;
+  buffer->capa = 0;
+  write_buffer_unref(buffer);
+}
+
+struct write_buffer_wait {
+  struct write_buffer *buffer;
+  uint64_t target;
+  int error;
+};
+
+static VALUE write_buffer_wait_loop(VALUE arg) {
+  struct write_buffer_wait *wait = (struct write_buffer_wait *)arg;
+  struct write_buffer *buffer = wait->buffer;
+
+  while (buffer->flushed < wait->target) {
+    if (buffer->closing) {
+      // uncorked or replaced before our data could be written out
+      wait->error = buffer->error ? buffer->error : EBADF;
+      break;
+    }
+    if (buffer->error) {
+      wait->error = buffer->error;
+      buffer->error = 0;
+      break;
+    }
+    Scheduler_io_wait_fptr(buffer->scheduler, buffer->fptr, EV_WRITE, Qnil);
+    if (!buffer->closing) write_buffer_try_flush(buffer);
+  }
+  return Qnil;
+}
+
+static VALUE write_buffer_wait_ensure(VALUE arg) {
+  write_buffer_unref(((struct write_buffer_wait *)arg)->buffer);
+  return Qnil;
+}
+
+// Writes out the buffered data followed by the given data (which may be
+// empty) using writev. If the fd is not writable, the rest of the data is
+// appended to the buffer, so writes from other fibers stay ordered, and the
+// fiber waits until it has been written out. Must be called from a fiber.
+static ssize_t write_buffer_flush(struct write_buffer *buffer, const char *base, size_t size) {
+  size_t written = 0;
+  while (1) {
+    struct iovec iov[2];
+    int count = 0;
+    if (buffer->len) iov[count++] = (struct iovec){ buffer->data, buffer->len };
+    if (written < size) iov[count++] = (struct iovec){ (char *)base + written, size - written };
+    if (!count) {
+      write_buffer_clear(buffer);
+      return size;
+    }
+
+    ssize_t ret = writev(buffer->fd, iov, count);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      int error = errno;
+      write_buffer_clear(buffer);
+      return -error;
+    }
+    size_t from_buffer = (size_t)ret < buffer->len ? (size_t)ret : buffer->len;
+    write_buffer_consume(buffer, from_buffer);
+    written += ret - from_buffer;
+  }
+
+  write_buffer_append(buffer, base + written, size - written);
+  struct write_buffer_wait wait = { buffer, buffer->flushed + buffer->len, 0 };
+  buffer->refcount++;
+  rb_ensure(write_buffer_wait_loop, (VALUE)&wait, write_buffer_wait_ensure, (VALUE)&wait);
+  return wait.error ? -wait.error : (ssize_t)size;
+}
+
+// Called from the io_write hook. Returns 0 if the IO is not corked. Otherwise,
+// stores the number of bytes written (or buffered), or -errno, in result.
+int Scheduler_corked_write(Scheduler_t *scheduler, rb_io_t *fptr, const char *base, size_t size, ssize_t *result) {
+  struct write_buffer *buffer = write_buffer_get(scheduler, fptr_fd(fptr));
+  if (!buffer || buffer->fptr != fptr) return 0;
+
+  if (buffer->error) {
+    *result = -buffer->error;
+    buffer->error = 0;
+  }
+  else if (buffer->len + size >= buffer->threshold)
+    *result = write_buffer_flush(buffer, base, size);
+  else {
+    write_buffer_append(buffer, base, size);
+    *result = size;
+  }
+  return 1;
+}
+
+void Scheduler_write_buffers_mark(Scheduler_t *scheduler) {
+  for (int i = 0; i < scheduler->write_buffers_size; i++)
+    if (scheduler->write_buffers[i]) rb_gc_mark(scheduler->write_buffers[i]->io_obj);
+}
+
+// Called from Scheduler_close, when the loop is still alive
+void Scheduler_write_buffers_free(Scheduler_t *scheduler) {
+  for (int i = 0; i < scheduler->write_buffers_size; i++)
+    if (scheduler->write_buffers[i]) write_buffer_close(scheduler, scheduler->write_buffers[i]);
+  if (scheduler->write_buffers) xfree(scheduler->write_buffers);
+  scheduler->write_buffers = NULL;
+  scheduler->write_buffers_size = 0;
+  if (ev_is_active(&scheduler->cork_prepare)) ev_prepare_stop(scheduler->ev_loop, &scheduler->cork_prepare);
+}
+
+// Called from Scheduler_free, releases memory without touching the loop
+void Scheduler_write_buffers_release(Scheduler_t *scheduler) {
+  for (int i = 0; i < scheduler->write_buffers_size; i++) {
+    struct write_buffer *buffer = scheduler->write_buffers[i];
+    if (!buffer) continue;
+    xfree(buffer->data);
+    xfree(buffer);
+  }
+  if (scheduler->write_buffers) xfree(scheduler->write_buffers);
+}
+
+// Starts coalescing writes to the given IO. Buffered data is flushed once per
+// loop iteration, or as soon as it reaches the given threshold (in bytes).
+VALUE Scheduler_cork(int argc, VALUE *argv, VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+  rb_check_arity(argc, 1, 2);
+
+  VALUE io = rb_io_get_io(argv[0]);
+  size_t threshold = argc == 2 ? NUM2SIZET(argv[1]) : CORK_DEFAULT_THRESHOLD;
+  if (!threshold) rb_raise(rb_eArgError, "threshold must be positive");
+  rb_io_t *fptr = Scheduler_get_fptr(io);
+  rb_io_check_writable(fptr);
+  int fd = fptr_fd(fptr);
+
+  struct write_buffer *buffer = write_buffer_get(scheduler, fd);
+  if (buffer) {
+    if (buffer->fptr == fptr) {
+      buffer->threshold = threshold;
+      return self;
+    }
+    // the previously corked IO was closed without being uncorked
+    write_buffer_close(scheduler, buffer);
+  }
+
+  if (fd >= scheduler->write_buffers_size) {
+    int size = scheduler->write_buffers_size ? scheduler->write_buffers_size : 64;
+    while (size <= fd) size *= 2;
+    REALLOC_N(scheduler->write_buffers, struct write_buffer *, size);
+    MEMZERO(scheduler->write_buffers + scheduler->write_buffers_size, struct write_buffer *, size - scheduler->write_buffers_size);
+    scheduler->write_buffers_size = size;
+  }
+
+  if (!ev_is_active(&scheduler->cork_prepare)) {
+    ev_prepare_init(&scheduler->cork_prepare, Scheduler_cork_prepare_callback);
+    ev_prepare_start(scheduler->ev_loop, &scheduler->cork_prepare);
+    ev_unref(scheduler->ev_loop);
+  }
+
+  buffer = ALLOC(struct write_buffer);
+  buffer->scheduler = scheduler;
+  buffer->io_obj = io;
+  buffer->fptr = fptr;
+  buffer->fd = fd;
+  buffer->data = NULL;
+  buffer->len = buffer->capa = 0;
+  buffer->threshold = threshold;
+  buffer->flushed = 0;
+  buffer->error = 0;
+  buffer->refcount = 1;
+  buffer->closing = 0;
+  buffer->next_dirty = NULL;
+  ev_io_init(&buffer->io, write_buffer_io_callback, fd, EV_WRITE);
+  scheduler->write_buffers[fd] = buffer;
+  return self;
+}
+
+// Flushes until the buffer is empty, including data appended by other fibers
+// while waiting.
+static VALUE uncork_flush(VALUE arg) {
+  struct write_buffer *buffer = (struct write_buffer *)arg;
+  ssize_t ret;
+  do
+    ret = write_buffer_flush(buffer, NULL, 0);
+  while (ret >= 0 && !buffer->closing && buffer->len);
+  return SSIZET2NUM(ret);
+}
+
+static VALUE uncork_ensure(VALUE arg) {
+  struct write_buffer *buffer = (struct write_buffer *)arg;
+  write_buffer_close(buffer->scheduler, buffer);
+  write_buffer_unref(buffer);
+  return Qnil;
+}
+
+// Flushes any buffered data and stops coalescing writes to the given IO. This
+// must be called before closing a corked IO.
+VALUE Scheduler_uncork(VALUE self, VALUE io) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  io = rb_io_get_io(io);
+  rb_io_t *fptr = Scheduler_get_fptr(io);
+  struct write_buffer *buffer = write_buffer_get(scheduler, fptr_fd(fptr));
+  if (!buffer || buffer->fptr != fptr) return self;
+
+  // the buffer may be closed by another fiber while this one is flushing it,
+  // and is closed even if the flush is interrupted
+  buffer->refcount++;
+  int error = buffer->error;
+  ssize_t ret = error ? 0 :
+    NUM2SSIZET(rb_ensure(uncork_flush, (VALUE)buffer, uncork_ensure, (VALUE)buffer));
+  if (error) {
+    write_buffer_close(scheduler, buffer);
+    write_buffer_unref(buffer);
+    rb_syserr_fail(error, "write");
+  }
+  if (ret < 0) rb_syserr_fail(-ret, "writev");
+  return self;
+}
+
+VALUE Scheduler_corked_p(VALUE self, VALUE io) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  rb_io_t *fptr = Scheduler_get_fptr(rb_io_get_io(io));
+  struct write_buffer *buffer = write_buffer_get(scheduler, fptr_fd(fptr));
+  return (buffer && buffer->fptr == fptr) ? Qtrue : Qfalse;
+}
+
+void Init_Cork(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  VALUE cScheduler = rb_const_get(mLibev, rb_intern("Scheduler"));
+
+  rb_define_method(cScheduler, "cork", Scheduler_cork, -1);
+  rb_define_method(cScheduler, "uncork", Scheduler_uncork, 1);
+  rb_define_method(cScheduler, "corked?", Scheduler_corked_p, 1);
+}
@@ -0,0 +1,186 @@
+#include "scheduler.h"
+
+// Embedding of scheduler loops. The loop of an embedded scheduler is polled as
+// part of the embedding scheduler's loop: with ev_embed, the embedded loop's
+// backend fd is watched by the embedding loop, so both loops are served by a
+// single blocking poll instead of two. Fibers made ready on the embedded
+// scheduler are resumed by the embedding scheduler after each poll.
+//
+// ev_embed does not account for the embedded loop's timers, so before each
+// poll a timer on the embedding loop is set to the embedded loop's earliest
+// timer.
+
+struct embedded_loop {
+  struct ev_embed embed;
+  struct ev_prepare prepare;
+  struct ev_timer timer;
+  Scheduler_t *parent;
+  Scheduler_t *child;
+  // each scheduler marks the other while embedded, so they are always
+  // collected together
+  VALUE parent_obj;
+  VALUE child_obj;
+  struct embedded_loop *next;
+};
+
+#define EMBEDDED_LOOP(ptr, member) \
+  ((struct embedded_loop *)((char *)(ptr) - offsetof(struct embedded_loop, member)))
+
+static void embedded_loop_prepare_callback(EV_P_ ev_prepare *w, int revents) {
+  struct embedded_loop *embedded = EMBEDDED_LOOP(w, prepare);
+  ev_tstamp timeout = ev_loop_next_timeout(embedded->child->ev_loop);
+
+  if (ev_is_active(&embedded->timer)) ev_timer_stop(EV_A_ &embedded->timer);
+  if (timeout >= 0) {
+    ev_timer_set(&embedded->timer, timeout, 0.);
+    ev_timer_start(EV_A_ &embedded->timer);
+  }
+}
+
+static void embedded_loop_timer_callback(EV_P_ ev_timer *w, int revents) {
+  ev_embed_sweep(EV_A_ &EMBEDDED_LOOP(w, timer)->embed);
+}
+
+int Scheduler_embedded_has_work(Scheduler_t *scheduler) {
+  for (struct embedded_loop *embedded = scheduler->embedded; embedded; embedded = embedded->next)
+    if (Scheduler_has_work(embedded->child)) return 1;
+  return 0;
+}
+
+// Returns the number of fibers ready on embedded schedulers, after pushing
+// their spawned fibers onto their runqueues
+unsigned int Scheduler_embedded_ready(Scheduler_t *scheduler) {
+  unsigned int count = 0;
+  for (struct embedded_loop *embedded = scheduler->embedded; embedded; embedded = embedded->next) {
+    Scheduler_t *child = embedded->child;
+    if (child->spawn_batches) Scheduler_flush_spawn_batches(child);
+    count += runqueue_len(&child->runqueue);
+    if (child->embedded) count += Scheduler_embedded_ready(child);
+  }
+  return count;
+}
+
+// Embedded schedulers count as polling while the embedding scheduler polls, so
+// fibers unblocked from other threads wake the loop up (through the embedded
+// loop's async watcher, which makes its backend fd readable).
+void Scheduler_embedded_set_polling(Scheduler_t *scheduler, unsigned int polling) {
+  for (struct embedded_loop *embedded = scheduler->embedded; embedded; embedded = embedded->next) {
+    embedded->child->currently_polling = polling;
+    if (embedded->child->embedded) Scheduler_embedded_set_polling(embedded->child, polling);
+  }
+}
+
+void Scheduler_embedded_resume(Scheduler_t *scheduler) {
+  for (struct embedded_loop *embedded = scheduler->embedded; embedded; embedded = embedded->next) {
+    Scheduler_resume_ready(embedded->child);
+    embedded->child->heartbeat++;
+    if (embedded->child->embedded) Scheduler_embedded_resume(embedded->child);
+  }
+}
+
+void Scheduler_embedded_mark(Scheduler_t *scheduler) {
+  for (struct embedded_loop *embedded = scheduler->embedded; embedded; embedded = embedded->next)
+    rb_gc_mark(embedded->child_obj);
+  if (scheduler->embedded_in) rb_gc_mark(scheduler->embedded_in->parent_obj);
+}
+
+// Called when the scheduler is collected. Embedded schedulers are collected
+// together with it, so they're not touched.
+void Scheduler_embedded_free(Scheduler_t *scheduler) {
+  while (scheduler->embedded) {
+    struct embedded_loop *embedded = scheduler->embedded;
+    scheduler->embedded = embedded->next;
+    xfree(embedded);
+  }
+}
+
+static void embedded_loop_stop(struct embedded_loop *embedded) {
+  struct ev_loop *ev_loop = embedded->parent->ev_loop;
+  ev_embed_stop(ev_loop, &embedded->embed);
+  ev_ref(ev_loop);
+  ev_prepare_stop(ev_loop, &embedded->prepare);
+  ev_timer_stop(ev_loop, &embedded->timer);
+
+  struct embedded_loop **ptr = &embedded->parent->embedded;
+  while (*ptr != embedded) ptr = &(*ptr)->next;
+  *ptr = embedded->next;
+  embedded->child->embedded_in = NULL;
+  embedded->child->currently_polling = 0;
+  xfree(embedded);
+}
+
+// Stops all embeddings the scheduler takes part in, called on close
+void Scheduler_unembed_all(Scheduler_t *scheduler) {
+  while (scheduler->embedded) embedded_loop_stop(scheduler->embedded);
+  if (scheduler->embedded_in) embedded_loop_stop(scheduler->embedded_in);
+}
+
+// Embeds the given scheduler's loop in this scheduler's loop. Both schedulers
+// must belong to the same thread, and the embedded one must use a backend that
+// supports embedding (epoll, kqueue). The embedded scheduler is run by this
+// one until unembedded or closed.
+VALUE Scheduler_embed(VALUE self, VALUE child_obj) {
+  Scheduler_t *parent;
+  Scheduler_t *child;
+  GetScheduler(self, parent);
+  GetScheduler(child_obj, child);
+
+  if (child->ev_loop == parent->ev_loop)
+    rb_raise(rb_eArgError, "cannot embed a scheduler sharing the same loop");
+  if (child->thread != parent->thread)
+    rb_raise(rb_eArgError, "cannot embed a scheduler belonging to another thread");
+  if (child->embedded_in)
+    rb_raise(rb_eRuntimeError, "scheduler is already embedded");
+  // the child must not be the parent or one of its ancestors
+  for (Scheduler_t *ancestor = parent; ancestor; ancestor = ancestor->embedded_in ? ancestor->embedded_in->parent : NULL)
+    if (ancestor == child) rb_raise(rb_eArgError, "cannot embed a scheduler in its own embedded scheduler");
+  if (!(ev_backend(child->ev_loop) & ev_embeddable_backends()))
+    rb_raise(rb_eRuntimeError, "scheduler backend does not support embedding");
+
+  struct embedded_loop *embedded = ALLOC(struct embedded_loop);
+  embedded->parent = parent;
+  embedded->child = child;
+  embedded->parent_obj = self;
+  embedded->child_obj = child_obj;
+
+  ev_embed_init(&embedded->embed, 0, child->ev_loop);
+  ev_embed_start(parent->ev_loop, &embedded->embed);
+  ev_prepare_init(&embedded->prepare, embedded_loop_prepare_callback);
+  ev_prepare_start(parent->ev_loop, &embedded->prepare);
+  ev_unref(parent->ev_loop); // don't count the prepare watcher
+  ev_timer_init(&embedded->timer, embedded_loop_timer_callback, 0., 0.);
+
+  embedded->next = parent->embedded;
+  parent->embedded = embedded;
+  child->embedded_in = embedded;
+  return self;
+}
+
+// Stops embedding the given scheduler's loop
+VALUE Scheduler_unembed(VALUE self, VALUE child_obj) {
+  Scheduler_t *parent;
+  Scheduler_t *child;
+  GetScheduler(self, parent);
+  GetScheduler(child_obj, child);
+
+  if (!child->embedded_in || child->embedded_in->parent != parent)
+    rb_raise(rb_eArgError, "scheduler is not embedded in this scheduler");
+  embedded_loop_stop(child->embedded_in);
+  return self;
+}
+
+VALUE Scheduler_embedded_p(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  return scheduler->embedded_in ? Qtrue : Qfalse;
+}
+
+void Init_Embed(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  VALUE cScheduler = rb_const_get(mLibev, rb_intern("Scheduler"));
+
+  rb_define_method(cScheduler, "embed", Scheduler_embed, 1);
+  rb_define_method(cScheduler, "unembed", Scheduler_unembed, 1);
+  rb_define_method(cScheduler, "embedded?", Scheduler_embedded_p, 0);
+}
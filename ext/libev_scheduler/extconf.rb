@@ -11,6 +11,11 @@ $defs << '-DEV_USE_EPOLL'        if have_header('sys/epoll.h')
 $defs << '-DEV_USE_KQUEUE'       if have_header('sys/event.h') && have_header('sys/queue.h')
 $defs << '-DEV_USE_PORT'         if have_type('port_event_t', 'port.h')
 $defs << '-DHAVE_SYS_RESOURCE_H' if have_header('sys/resource.h')  
+$defs << '-DHAVE_SYS_SDT_H'      if have_header('sys/sdt.h')
+$defs << '-DHAVE_SYS_SENDFILE_H' if have_header('sys/sendfile.h')
+$defs << '-DHAVE_SPLICE'         if have_func('splice', 'fcntl.h')
+$defs << '-DHAVE_SENDFILE'       if have_func('sendfile', 'sys/sendfile.h')
+$defs << '-DHAVE_RUBY_IO_BUFFER_H' if have_header('ruby/io/buffer.h')
 $CFLAGS << " -Wno-comment"
 $CFLAGS << " -Wno-unused-result"
 $CFLAGS << " -Wno-dangling-else"
@@ -0,0 +1,397 @@
+#include "scheduler.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_RUBY_IO_BUFFER_H
+#include "ruby/io/buffer.h"
+#endif
+
+// Non-blocking IO for regular files. Regular files are always reported as
+// ready by readiness-based backends, so a read or write on a slow disk would
+// block the whole event loop. Instead, file operations are handed to a small
+// pool of native worker threads, and the waiting fiber is resumed when the
+// worker signals completion through the scheduler's async watcher. Other fds
+// (sockets, pipes, ttys) are read and written directly, waiting for readiness
+// on EAGAIN.
+
+#define FILE_IO_POOL_SIZE 4
+
+enum file_io_op {
+  FILE_IO_READ,
+  FILE_IO_WRITE,
+  FILE_IO_PREAD,
+  FILE_IO_PWRITE,
+  FILE_IO_FSYNC
+};
+
+struct file_io_job {
+  enum file_io_op op;
+  int fd;
+  void *buf;
+  size_t len;
+  off_t offset;
+  ssize_t result; // -errno on error
+  int done;       // set on the scheduler thread once the job is collected
+  Scheduler_t *scheduler;
+  VALUE fiber;
+  struct file_io_job *next;
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static struct file_io_job *pool_head = NULL;
+static struct file_io_job *pool_tail = NULL;
+static int pool_started = 0;
+
+static void file_io_job_run(struct file_io_job *job) {
+  ssize_t ret;
+  do {
+    switch (job->op) {
+      case FILE_IO_READ:   ret = read(job->fd, job->buf, job->len); break;
+      case FILE_IO_WRITE:  ret = write(job->fd, job->buf, job->len); break;
+      case FILE_IO_PREAD:  ret = pread(job->fd, job->buf, job->len, job->offset); break;
+      case FILE_IO_PWRITE: ret = pwrite(job->fd, job->buf, job->len, job->offset); break;
+      case FILE_IO_FSYNC:  ret = fsync(job->fd); break;
+      default:             ret = -1; errno = EINVAL;
+    }
+  } while (ret < 0 && errno == EINTR);
+  job->result = ret < 0 ? -errno : ret;
+}
+
+static void *file_io_worker(void *arg) {
+  while (1) {
+    pthread_mutex_lock(&pool_lock);
+    while (!pool_head) pthread_cond_wait(&pool_cond, &pool_lock);
+    struct file_io_job *job = pool_head;
+    pool_head = job->next;
+    if (!pool_head) pool_tail = NULL;
+    pthread_mutex_unlock(&pool_lock);
+
+    file_io_job_run(job);
+
+    // The async is sent while holding the lock, so the scheduler cannot collect
+    // the job (and possibly be freed) before we're done touching it.
+    Scheduler_t *scheduler = job->scheduler;
+    pthread_mutex_lock(&scheduler->file_io_lock);
+    job->next = scheduler->file_io_completed;
+    scheduler->file_io_completed = job;
+    ev_async_send(scheduler->ev_loop, &scheduler->break_async);
+    pthread_mutex_unlock(&scheduler->file_io_lock);
+  }
+  return NULL;
+}
+
+// Worker threads do not survive fork, so the pool is restarted on demand
+static void file_io_atfork_child(void) {
+  pthread_mutex_init(&pool_lock, NULL);
+  pthread_cond_init(&pool_cond, NULL);
+  pool_head = pool_tail = NULL;
+  pool_started = 0;
+}
+
+// Called with pool_lock held
+static void file_io_pool_start(void) {
+  sigset_t all, old;
+  pthread_attr_t attr;
+  pthread_t thread;
+
+  // workers should never receive signals meant for Ruby threads
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for (int i = 0; i < FILE_IO_POOL_SIZE; i++) {
+    if (pthread_create(&thread, &attr, file_io_worker, NULL)) break;
+    pool_started++;
+  }
+  pthread_attr_destroy(&attr);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static int file_io_submit(struct file_io_job *job) {
+  job->next = NULL;
+  pthread_mutex_lock(&pool_lock);
+  if (!pool_started) file_io_pool_start();
+  if (!pool_started) {
+    pthread_mutex_unlock(&pool_lock);
+    return -1;
+  }
+  if (pool_tail) pool_tail->next = job;
+  else pool_head = job;
+  pool_tail = job;
+  pthread_cond_signal(&pool_cond);
+  pthread_mutex_unlock(&pool_lock);
+  return 0;
+}
+
+// Called from the break_async callback on the scheduler thread
+void Scheduler_file_io_complete(Scheduler_t *scheduler) {
+  pthread_mutex_lock(&scheduler->file_io_lock);
+  struct file_io_job *job = scheduler->file_io_completed;
+  scheduler->file_io_completed = NULL;
+  pthread_mutex_unlock(&scheduler->file_io_lock);
+
+  while (job) {
+    struct file_io_job *next = job->next;
+    job->done = 1;
+    SCHEDULE(scheduler, job->fiber);
+    job = next;
+  }
+}
+
+// Runs the given job on the worker pool and waits for its completion. The job
+// lives on the fiber's stack and the worker may be writing into the caller's
+// buffer, so the wait cannot be cut short: an exception raised into the fiber
+// is held until the job is done, then re-raised.
+static ssize_t file_io_run(Scheduler_t *scheduler, struct file_io_job *job) {
+  job->scheduler = scheduler;
+  job->fiber = rb_fiber_current();
+  job->done = 0;
+  if (file_io_submit(job)) {
+    file_io_job_run(job);
+    return job->result;
+  }
+
+  int raised = 0;
+  VALUE exception = Qnil;
+  ev_ref(scheduler->ev_loop);
+  scheduler->pending_count++;
+  while (!job->done) {
+    int state;
+    VALUE ret = YIELD(&state);
+    if (state) {
+      raised = state;
+      exception = rb_errinfo();
+    }
+    else if (RESUMED_WITH_EXCEPTION(ret))
+      exception = ret;
+  }
+  scheduler->pending_count--;
+  ev_unref(scheduler->ev_loop);
+  if (raised && !RESUMED_WITH_EXCEPTION(exception)) rb_jump_tag(raised);
+  if (!NIL_P(exception)) rb_exc_raise(exception);
+
+  return job->result;
+}
+
+static int fd_kind(Scheduler_t *scheduler, VALUE io, rb_io_t *fptr) {
+  int fd = fptr_fd(fptr);
+  if (fd >= scheduler->fd_kinds_size) {
+    int size = scheduler->fd_kinds_size ? scheduler->fd_kinds_size : 64;
+    while (size <= fd) size *= 2;
+    REALLOC_N(scheduler->fd_kinds, struct fd_kind, size);
+    MEMZERO(scheduler->fd_kinds + scheduler->fd_kinds_size, struct fd_kind, size - scheduler->fd_kinds_size);
+    scheduler->fd_kinds_size = size;
+  }
+
+  // a closed IO's fd (and rb_io_t address) can be reused by another IO, so the
+  // entry is only valid for the same object, still owning the same rb_io_t
+  struct fd_kind *entry = &scheduler->fd_kinds[fd];
+  if (!(entry->kind && entry->io == io && entry->fptr == fptr && RB_TYPE_P(io, T_FILE) && RFILE(io)->fptr == fptr)) {
+    struct stat st;
+    entry->io = io;
+    entry->fptr = fptr;
+    entry->kind = FD_KIND_KNOWN;
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode)) entry->kind |= FD_KIND_REGULAR;
+  }
+  if (entry->kind & FD_KIND_REGULAR) return entry->kind;
+
+  int flags = fcntl(fd, F_GETFL);
+  return (flags != -1 && (flags & O_NONBLOCK)) ? entry->kind | FD_KIND_NONBLOCK : entry->kind;
+}
+
+// Transfers at least length bytes (at least one chunk if length is 0). A short
+// read at EOF returns the number of bytes read so far. Returns -errno if an
+// error occurs before any data is transferred.
+static ssize_t file_io_transfer(Scheduler_t *scheduler, VALUE io, rb_io_t *fptr, enum file_io_op op, char *base, size_t size, size_t length, off_t from) {
+  int kind = fd_kind(scheduler, io, fptr);
+  int writing = (op == FILE_IO_WRITE || op == FILE_IO_PWRITE);
+  int mask = writing ? EV_WRITE : EV_READ;
+  size_t total = 0;
+
+  if (length > size) length = size;
+  while (1) {
+    ssize_t ret;
+    if (kind & FD_KIND_REGULAR) {
+      struct file_io_job job = {
+        .op = op, .fd = fptr_fd(fptr), .buf = base + total, .len = size - total,
+        .offset = from + total
+      };
+      ret = file_io_run(scheduler, &job);
+    }
+    else {
+      // blocking fds are only touched once ready, so as not to block the loop
+      if (!(kind & FD_KIND_NONBLOCK)) Scheduler_io_wait_fptr(scheduler, fptr, mask, Qnil);
+      switch (op) {
+        case FILE_IO_READ:   ret = read(fptr_fd(fptr), base + total, size - total); break;
+        case FILE_IO_WRITE:  ret = write(fptr_fd(fptr), base + total, size - total); break;
+        case FILE_IO_PREAD:  ret = pread(fptr_fd(fptr), base + total, size - total, from + total); break;
+        case FILE_IO_PWRITE: ret = pwrite(fptr_fd(fptr), base + total, size - total, from + total); break;
+        default:             ret = -1; errno = EINVAL;
+      }
+      if (ret < 0) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          Scheduler_io_wait_fptr(scheduler, fptr, mask, Qnil);
+          continue;
+        }
+        ret = -errno;
+      }
+    }
+
+    if (ret < 0) return total ? (ssize_t)total : ret;
+    if (ret == 0) break;
+    total += ret;
+    if (total >= length) break;
+  }
+  return total;
+}
+
+#ifdef HAVE_RUBY_IO_BUFFER_H
+
+static ssize_t Scheduler_io_buffer_transfer(VALUE self, VALUE io, VALUE buffer, enum file_io_op op, size_t length, size_t offset, off_t from) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  rb_io_t *fptr = Scheduler_io_fptr(scheduler, io);
+  void *base;
+  size_t size;
+  if (op == FILE_IO_READ || op == FILE_IO_PREAD)
+    rb_io_buffer_get_bytes_for_writing(buffer, &base, &size);
+  else
+    rb_io_buffer_get_bytes_for_reading(buffer, (const void **)&base, &size);
+  if (offset > size) rb_raise(rb_eArgError, "offset exceeds buffer size");
+
+  return file_io_transfer(scheduler, io, fptr, op, (char *)base + offset, size - offset, length, from);
+}
+
+// io_read(io, buffer, length[, offset]) fiber scheduler hook
+VALUE Scheduler_io_read(int argc, VALUE *argv, VALUE self) {
+  rb_check_arity(argc, 3, 4);
+  size_t offset = argc == 4 ? NUM2SIZET(argv[3]) : 0;
+  return SSIZET2NUM(Scheduler_io_buffer_transfer(self, argv[0], argv[1], FILE_IO_READ, NUM2SIZET(argv[2]), offset, 0));
+}
+
+// io_write(io, buffer, length[, offset]) fiber scheduler hook
+VALUE Scheduler_io_write(int argc, VALUE *argv, VALUE self) {
+  rb_check_arity(argc, 3, 4);
+  size_t offset = argc == 4 ? NUM2SIZET(argv[3]) : 0;
+
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+  rb_io_t *fptr = Scheduler_io_fptr(scheduler, argv[0]);
+  if (fptr_fd(fptr) < scheduler->write_buffers_size) {
+    const void *base;
+    size_t size;
+    ssize_t result;
+    rb_io_buffer_get_bytes_for_reading(argv[1], &base, &size);
+    if (offset > size) rb_raise(rb_eArgError, "offset exceeds buffer size");
+    if (Scheduler_corked_write(scheduler, fptr, (const char *)base + offset, size - offset, &result))
+      return SSIZET2NUM(result);
+  }
+
+  return SSIZET2NUM(Scheduler_io_buffer_transfer(self, argv[0], argv[1], FILE_IO_WRITE, NUM2SIZET(argv[2]), offset, 0));
+}
+
+// The io_pread/io_pwrite hooks are not implemented: Ruby 3.3 invokes them from
+// within a blocking region, i.e. without holding the GVL. Positional IO is
+// provided by Scheduler#pread and Scheduler#pwrite instead.
+
+#endif /* HAVE_RUBY_IO_BUFFER_H */
+
+struct positional_io_ctx {
+  Scheduler_t *scheduler;
+  VALUE io;
+  rb_io_t *fptr;
+  enum file_io_op op;
+  char *buf; // not on the Ruby heap, so it cannot be moved by GC compaction
+  size_t len;
+  off_t offset;
+};
+
+static VALUE positional_io_body(VALUE arg) {
+  struct positional_io_ctx *ctx = (struct positional_io_ctx *)arg;
+  ssize_t ret = file_io_transfer(ctx->scheduler, ctx->io, ctx->fptr, ctx->op, ctx->buf, ctx->len, ctx->len, ctx->offset);
+  if (ret < 0) rb_syserr_fail(-ret, ctx->op == FILE_IO_PREAD ? "pread" : "pwrite");
+
+  if (ctx->op == FILE_IO_PWRITE) return SSIZET2NUM(ret);
+  if (ret == 0 && ctx->len > 0) rb_eof_error();
+  return rb_str_new(ctx->buf, ret);
+}
+
+static VALUE positional_io_ensure(VALUE arg) {
+  struct positional_io_ctx *ctx = (struct positional_io_ctx *)arg;
+  xfree(ctx->buf);
+  return Qnil;
+}
+
+// Reads up to length bytes from the given IO at the given offset, without
+// blocking the loop. Raises EOFError at EOF.
+VALUE Scheduler_pread(VALUE self, VALUE io, VALUE length, VALUE offset) {
+  struct positional_io_ctx ctx;
+  GetScheduler(self, ctx.scheduler);
+
+  ctx.io = rb_io_get_io(io);
+  ctx.fptr = Scheduler_get_fptr(ctx.io);
+  rb_io_check_readable(ctx.fptr);
+  ctx.op = FILE_IO_PREAD;
+  ctx.len = NUM2SIZET(length);
+  ctx.offset = NUM2OFFT(offset);
+  ctx.buf = ALLOC_N(char, ctx.len);
+
+  return rb_ensure(positional_io_body, (VALUE)&ctx, positional_io_ensure, (VALUE)&ctx);
+}
+
+// Writes the given string to the given IO at the given offset, without
+// blocking the loop. Returns the number of bytes written.
+VALUE Scheduler_pwrite(VALUE self, VALUE io, VALUE str, VALUE offset) {
+  struct positional_io_ctx ctx;
+  GetScheduler(self, ctx.scheduler);
+
+  ctx.io = io = rb_io_get_io(io);
+  ctx.fptr = Scheduler_get_fptr(io);
+  rb_io_check_writable(ctx.fptr);
+  rb_io_flush(io);
+  StringValue(str);
+  ctx.op = FILE_IO_PWRITE;
+  ctx.len = RSTRING_LEN(str);
+  ctx.offset = NUM2OFFT(offset);
+  ctx.buf = ALLOC_N(char, ctx.len);
+  memcpy(ctx.buf, RSTRING_PTR(str), ctx.len);
+
+  return rb_ensure(positional_io_body, (VALUE)&ctx, positional_io_ensure, (VALUE)&ctx);
+}
+
+// Flushes the given IO and syncs its data to disk without blocking the loop.
+VALUE Scheduler_fsync(VALUE self, VALUE io) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  io = rb_io_get_io(io);
+  rb_io_t *fptr = Scheduler_get_fptr(io);
+  rb_io_check_writable(fptr);
+  rb_io_flush(io);
+
+  struct file_io_job job = { .op = FILE_IO_FSYNC, .fd = fptr_fd(fptr) };
+  ssize_t ret = file_io_run(scheduler, &job);
+  if (ret < 0) rb_syserr_fail(-ret, "fsync");
+  return INT2FIX(0);
+}
+
+void Init_FileIO(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  VALUE cScheduler = rb_const_get(mLibev, rb_intern("Scheduler"));
+
+  pthread_atfork(NULL, NULL, file_io_atfork_child);
+
+#ifdef HAVE_RUBY_IO_BUFFER_H
+  rb_define_method(cScheduler, "io_read", Scheduler_io_read, -1);
+  rb_define_method(cScheduler, "io_write", Scheduler_io_write, -1);
+#endif
+  rb_define_method(cScheduler, "pread", Scheduler_pread, 3);
+  rb_define_method(cScheduler, "pwrite", Scheduler_pwrite, 3);
+  rb_define_method(cScheduler, "fsync", Scheduler_fsync, 1);
+}
@@ -0,0 +1,193 @@
+#include "scheduler.h"
+#include "ruby/fiber/scheduler.h"
+
+// File change notifications, using ev_stat. libev watches the path with
+// inotify where available (falling back to polling it with stat at the given
+// interval, 5 seconds by default), and reports a change whenever the path's
+// stat data differs from the previous one. A path that does not exist has all
+// stat fields zeroed, so creation and deletion are reported as changes.
+
+struct file_watch {
+  struct ev_stat stat;
+  struct ev_timer timer;
+  Scheduler_t *scheduler;
+  VALUE fiber;
+  int waiting;   // fiber is suspended waiting for a change
+  int changed;   // change reported since last checked
+  int timed_out; // timer fired
+};
+
+static void file_watch_wake(struct file_watch *watch) {
+  if (!watch->waiting) return;
+
+  watch->waiting = 0;
+  SCHEDULE(watch->scheduler, watch->fiber);
+}
+
+static void file_watch_stat_callback(EV_P_ ev_stat *w, int revents) {
+  struct file_watch *watch = (struct file_watch *)w;
+  watch->changed = 1;
+  file_watch_wake(watch);
+}
+
+static void file_watch_timer_callback(EV_P_ ev_timer *w, int revents) {
+  struct file_watch *watch = (struct file_watch *)((char *)w - offsetof(struct file_watch, timer));
+  watch->timed_out = 1;
+  file_watch_wake(watch);
+}
+
+static void file_watch_init(struct file_watch *watch, Scheduler_t *scheduler, const char *path, double interval) {
+  watch->scheduler = scheduler;
+  watch->fiber = rb_fiber_current();
+  watch->waiting = 0;
+  watch->changed = 0;
+  watch->timed_out = 0;
+  ev_stat_init(&watch->stat, file_watch_stat_callback, path, interval);
+  ev_init(&watch->timer, file_watch_timer_callback);
+}
+
+// Waits for a change, or for the timer to fire if started. Returns the resume
+// value.
+static VALUE file_watch_wait(struct file_watch *watch, int *state) {
+  watch->waiting = 1;
+  watch->scheduler->pending_count++;
+  VALUE ret = YIELD(state);
+  watch->scheduler->pending_count--;
+  if (watch->waiting) {
+    // resumed by an exception, before being woken
+    watch->waiting = 0;
+  }
+  else if (*state || RESUMED_WITH_EXCEPTION(ret))
+    runqueue_delete(&watch->scheduler->runqueue, watch->fiber);
+  return ret;
+}
+
+static VALUE file_stat_value(const ev_statdata *st) {
+  return st->st_nlink ? rb_stat_new(st) : Qnil;
+}
+
+static VALUE file_watch_stats(struct file_watch *watch) {
+  return rb_assoc_new(file_stat_value(&watch->stat.prev), file_stat_value(&watch->stat.attr));
+}
+
+static Scheduler_t *file_watch_scheduler(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  if (waiter_current_scheduler(rb_fiber_scheduler_current()) != scheduler)
+    rb_raise(rb_eRuntimeError, "must be called from a fiber running on this scheduler");
+  return scheduler;
+}
+
+static ID ID_file_watch_options[2];
+
+// Parses the interval option, and the timeout option if timeout is not NULL
+static void file_watch_options(VALUE opts, double *timeout, double *interval) {
+  VALUE values[2] = {Qundef, Qundef};
+  if (!NIL_P(opts)) {
+    if (timeout)
+      rb_get_kwargs(opts, ID_file_watch_options, 0, 2, values);
+    else
+      rb_get_kwargs(opts, ID_file_watch_options + 1, 0, 1, values + 1);
+  }
+  if (values[0] != Qundef && !NIL_P(values[0])) {
+    *timeout = NUM2DBL(values[0]);
+    if (*timeout < 0) *timeout = 0;
+  }
+  if (values[1] != Qundef && !NIL_P(values[1])) *interval = NUM2DBL(values[1]);
+}
+
+// wait_file_change(path, timeout: nil, interval: nil)
+//
+// Waits for the file at the given path to change (including being created or
+// deleted). Returns the previous and current stat data as a pair of File::Stat
+// objects (nil for a missing file), or nil on timeout. The interval is used for
+// stat polling when inotify is not available.
+VALUE Scheduler_wait_file_change(int argc, VALUE *argv, VALUE self) {
+  VALUE path, opts;
+  double timeout = -1, interval = 0;
+  rb_scan_args(argc, argv, "1:", &path, &opts);
+  file_watch_options(opts, &timeout, &interval);
+  Scheduler_t *scheduler = file_watch_scheduler(self);
+
+  path = rb_str_new_frozen(rb_get_path(path));
+  struct file_watch watch;
+  file_watch_init(&watch, scheduler, RSTRING_PTR(path), interval);
+  ev_stat_start(scheduler->ev_loop, &watch.stat);
+  if (timeout >= 0) {
+    ev_timer_set(&watch.timer, timeout, 0.);
+    ev_timer_start(scheduler->ev_loop, &watch.timer);
+  }
+
+  // a resume not caused by the watchers (e.g. a stale runqueue entry) is not
+  // taken for a change or a timeout
+  int state = 0;
+  VALUE ret = Qnil;
+  while (!watch.changed && !watch.timed_out) {
+    ret = file_watch_wait(&watch, &state);
+    if (state || RESUMED_WITH_EXCEPTION(ret)) break;
+  }
+  ev_stat_stop(scheduler->ev_loop, &watch.stat);
+  ev_timer_stop(scheduler->ev_loop, &watch.timer);
+  RAISE_IF_EXCEPTION(state, ret);
+
+  RB_GC_GUARD(path);
+  RB_GC_GUARD(watch.fiber);
+  return watch.changed ? file_watch_stats(&watch) : Qnil;
+}
+
+static VALUE file_watch_loop(VALUE arg) {
+  struct file_watch *watch = (struct file_watch *)arg;
+  while (1) {
+    while (!watch->changed) {
+      int state;
+      VALUE ret = file_watch_wait(watch, &state);
+      RAISE_IF_EXCEPTION(state, ret);
+    }
+    watch->changed = 0;
+    rb_yield_values(2, file_stat_value(&watch->stat.prev), file_stat_value(&watch->stat.attr));
+  }
+  return Qnil;
+}
+
+static VALUE file_watch_stop(VALUE arg) {
+  struct file_watch *watch = (struct file_watch *)arg;
+  ev_stat_stop(watch->scheduler->ev_loop, &watch->stat);
+  return Qnil;
+}
+
+// watch_file(path, interval: nil) { |prev, cur| ... }
+//
+// Watches the file at the given path, calling the given block with the previous
+// and current stat data (File::Stat, or nil for a missing file) on each change.
+// The path stays watched while the block runs, and changes made in the meantime
+// are coalesced into a single call. Runs until the block breaks (or raises).
+VALUE Scheduler_watch_file(int argc, VALUE *argv, VALUE self) {
+  VALUE path, opts;
+  double interval = 0;
+  rb_scan_args(argc, argv, "1:", &path, &opts);
+  rb_need_block();
+  file_watch_options(opts, NULL, &interval);
+  Scheduler_t *scheduler = file_watch_scheduler(self);
+
+  path = rb_str_new_frozen(rb_get_path(path));
+  struct file_watch watch;
+  file_watch_init(&watch, scheduler, RSTRING_PTR(path), interval);
+  ev_stat_start(scheduler->ev_loop, &watch.stat);
+
+  VALUE ret = rb_ensure(file_watch_loop, (VALUE)&watch, file_watch_stop, (VALUE)&watch);
+  RB_GC_GUARD(path);
+  RB_GC_GUARD(watch.fiber);
+  return ret;
+}
+
+void Init_FileWatch(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  VALUE cScheduler = rb_const_get(mLibev, rb_intern("Scheduler"));
+
+  ID_file_watch_options[0] = rb_intern("timeout");
+  ID_file_watch_options[1] = rb_intern("interval");
+
+  rb_define_method(cScheduler, "wait_file_change", Scheduler_wait_file_change, -1);
+  rb_define_method(cScheduler, "watch_file", Scheduler_watch_file, -1);
+}
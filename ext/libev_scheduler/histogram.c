@@ -0,0 +1,38 @@
+#include <string.h>
+#include "histogram.h"
+
+void histogram_reset(histogram_t *histogram) {
+  memset(histogram, 0, sizeof(histogram_t));
+  histogram->min = UINT64_MAX;
+}
+
+// Returns the midpoint of the given bucket's value range
+static uint64_t histogram_bucket_value(unsigned int idx) {
+  if (idx < HISTOGRAM_SUB_COUNT) return idx;
+
+  unsigned int shift = idx / HISTOGRAM_SUB_COUNT - 1;
+  unsigned int sub = idx % HISTOGRAM_SUB_COUNT;
+  uint64_t low = ((uint64_t)(HISTOGRAM_SUB_COUNT + sub)) << shift;
+  return low + ((1ULL << shift) >> 1);
+}
+
+uint64_t histogram_percentile(histogram_t *histogram, double percentile) {
+  if (!histogram->count) return 0;
+  if (percentile <= 0) return histogram->min;
+  if (percentile >= 100) return histogram->max;
+
+  uint64_t target = (uint64_t)(percentile / 100 * histogram->count + 0.5);
+  if (target < 1) target = 1;
+
+  uint64_t seen = 0;
+  for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= target) {
+      uint64_t value = histogram_bucket_value(i);
+      if (value < histogram->min) return histogram->min;
+      if (value > histogram->max) return histogram->max;
+      return value;
+    }
+  }
+  return histogram->max;
+}
@@ -0,0 +1,55 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Log-linear (HDR-style) histogram. Values below HISTOGRAM_SUB_COUNT are
+// counted exactly, and every power of two above that is split into
+// HISTOGRAM_SUB_COUNT linear sub-buckets, giving a relative error of at most
+// 1/HISTOGRAM_SUB_COUNT. All storage is inline, so recording a sample never
+// allocates.
+#define HISTOGRAM_SUB_BITS  4
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS  47 // values are clamped to ~39 hours (in ns)
+#define HISTOGRAM_BUCKETS   (HISTOGRAM_SUB_COUNT * (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 2))
+
+typedef struct histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+void histogram_reset(histogram_t *histogram);
+uint64_t histogram_percentile(histogram_t *histogram, double percentile);
+
+static inline uint64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned int histogram_bucket_index(uint64_t value) {
+  if (value < HISTOGRAM_SUB_COUNT) return (unsigned int)value;
+
+  unsigned int msb = 63 - __builtin_clzll(value);
+  if (msb > HISTOGRAM_MAX_BITS) {
+    msb = HISTOGRAM_MAX_BITS;
+    value = (1ULL << (HISTOGRAM_MAX_BITS + 1)) - 1;
+  }
+  unsigned int shift = msb - HISTOGRAM_SUB_BITS;
+  unsigned int sub = (unsigned int)(value >> shift) - HISTOGRAM_SUB_COUNT;
+  return (shift + 1) * HISTOGRAM_SUB_COUNT + sub;
+}
+
+static inline void histogram_record(histogram_t *histogram, uint64_t value) {
+  histogram->buckets[histogram_bucket_index(value)]++;
+  histogram->count++;
+  histogram->sum += value;
+  if (value < histogram->min) histogram->min = value;
+  if (value > histogram->max) histogram->max = value;
+}
+
+#endif /* HISTOGRAM_H */
@@ -0,0 +1,58 @@
+#include "scheduler.h"
+#include "ruby/fiber/scheduler.h"
+
+// Idle-priority fibers, using ev_idle. Fibers waiting in wait_idle are resumed
+// from an idle watcher at the lowest priority, which libev only invokes on loop
+// iterations with no pending I/O, timer or other events. One waiting fiber is
+// resumed per idle iteration, and only if no other fibers are ready to run, so
+// the loop is polled again between each slice of background work.
+
+void Scheduler_idle_mark(Scheduler_t *scheduler) {
+  waiter_list_mark(&scheduler->idle_waiters);
+}
+
+static void idle_callback(EV_P_ ev_idle *w, int revents) {
+  Scheduler_t *scheduler = (Scheduler_t *)((char *)w - offsetof(Scheduler_t, idle));
+
+  if (runqueue_len(&scheduler->runqueue) == 0) {
+    struct waiter *waiter = waiter_list_shift(&scheduler->idle_waiters);
+    if (waiter) waiter_wake(waiter, WAITER_DONE);
+  }
+  if (!scheduler->idle_waiters.head) ev_idle_stop(EV_A_ w);
+}
+
+void Scheduler_idle_init(Scheduler_t *scheduler) {
+  scheduler->idle_waiters = (struct waiter_list){ NULL, NULL };
+  ev_idle_init(&scheduler->idle, idle_callback);
+  ev_set_priority(&scheduler->idle, EV_MINPRI);
+}
+
+void Scheduler_idle_stop(Scheduler_t *scheduler) {
+  ev_idle_stop(scheduler->ev_loop, &scheduler->idle);
+}
+
+// Waits until the loop is idle, i.e. no I/O or timer events are pending and no
+// other fibers are ready to run. Long running background work should call it
+// periodically to let other fibers run. Must be called from a fiber running on
+// this scheduler.
+VALUE Scheduler_wait_idle(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  if (waiter_current_scheduler(rb_fiber_scheduler_current()) != scheduler)
+    rb_raise(rb_eRuntimeError, "must be called from a fiber running on this scheduler");
+
+  struct waiter waiter = { .blocker = self, .value = Qnil };
+  ev_idle_start(scheduler->ev_loop, &scheduler->idle);
+  int state;
+  VALUE ret = waiter_wait(&scheduler->idle_waiters, &waiter, &state);
+  RAISE_IF_EXCEPTION(state, ret);
+  return self;
+}
+
+void Init_Idle(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  VALUE cScheduler = rb_const_get(mLibev, rb_intern("Scheduler"));
+
+  rb_define_method(cScheduler, "wait_idle", Scheduler_wait_idle, 0);
+}
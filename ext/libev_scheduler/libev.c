@@ -1,2 +1,110 @@
 #include "libev.h"
 #include "../libev/ev.c"
+
+/* ev.c undefines the loop variable accessors at its end */
+#if EV_MULTIPLICITY
+# include "../libev/ev_wrap.h"
+#endif
+
+/* Pre-sizes the loop's internal tables for the given number of fds and
+ * timers, so they don't need to be grown (and copied) under load. */
+void
+ev_loop_reserve (EV_P_ int expected_fds, int expected_timers)
+{
+  if (expected_fds > 0)
+    {
+      array_needsize (ANFD, anfds, anfdmax, expected_fds, array_needsize_zerofill);
+      array_needsize (int, fdchanges, fdchangemax, expected_fds, array_needsize_noinit);
+      array_needsize (ANPENDING, pendings [-EV_MINPRI], pendingmax [-EV_MINPRI], expected_fds, array_needsize_noinit);
+#if EV_USE_EPOLL
+      if (backend == EVBACKEND_EPOLL && epoll_eventmax < expected_fds)
+        {
+          ev_free (epoll_events);
+          epoll_eventmax = expected_fds;
+          epoll_events = (struct epoll_event *)ev_malloc (sizeof (struct epoll_event) * epoll_eventmax);
+        }
+#endif
+    }
+
+  if (expected_timers > 0)
+    array_needsize (ANHE, timers, timermax, expected_timers + HEAP0, array_needsize_noinit);
+}
+
+/* Releases memory held by the loop's internal tables beyond what is currently
+ * in use. Must not be called from within a watcher callback. */
+void
+ev_loop_shrink (EV_P)
+{
+  int fdmax = anfdmax;
+  int pri;
+
+  while (fdmax > 0 && !anfds [fdmax - 1].head && !anfds [fdmax - 1].reify && !anfds [fdmax - 1].eflags)
+    --fdmax;
+
+  if (fdmax < anfdmax)
+    {
+      anfds = (ANFD *)ev_realloc (anfds, sizeof (ANFD) * fdmax);
+      anfdmax = fdmax;
+    }
+
+  if (fdchangecnt < fdchangemax)
+    {
+      fdchanges = (int *)ev_realloc (fdchanges, sizeof (int) * fdchangecnt);
+      fdchangemax = fdchangecnt;
+    }
+
+  for (pri = NUMPRI; pri--; )
+    if (pendingcnt [pri] < pendingmax [pri])
+      {
+        pendings [pri] = (ANPENDING *)ev_realloc (pendings [pri], sizeof (ANPENDING) * pendingcnt [pri]);
+        pendingmax [pri] = pendingcnt [pri];
+      }
+
+  if (timercnt + HEAP0 < timermax)
+    {
+      timers = (ANHE *)ev_realloc (timers, sizeof (ANHE) * (timercnt + HEAP0));
+      timermax = timercnt + HEAP0;
+    }
+
+#if EV_USE_EPOLL
+  if (backend == EVBACKEND_EPOLL && epoll_eventmax > 64)
+    {
+      ev_free (epoll_events);
+      epoll_eventmax = 64;
+      epoll_events = (struct epoll_event *)ev_malloc (sizeof (struct epoll_event) * epoll_eventmax);
+    }
+#endif
+}
+
+/* Returns the time (in seconds) until the loop's earliest timer or periodic is
+ * due, 0 if already overdue, or -1 if the loop has none. */
+ev_tstamp
+ev_loop_next_timeout (EV_P)
+{
+  ev_tstamp next = -1.;
+
+  if (timercnt)
+    {
+      next = ANHE_at (timers [HEAP0]) - get_clock ();
+      if (next < 0.) next = 0.;
+    }
+
+#if EV_PERIODIC_ENABLE
+  if (periodiccnt)
+    {
+      ev_tstamp at = ANHE_at (periodics [HEAP0]) - ev_time ();
+      if (at < 0.) at = 0.;
+      if (next < 0. || at < next) next = at;
+    }
+#endif
+
+  return next;
+}
+
+/* Returns the fd used by the loop's backend (e.g. the epoll fd), or -1 if the
+ * backend does not use one. */
+int
+ev_loop_backend_fd (EV_P)
+{
+  return backend_fd;
+}
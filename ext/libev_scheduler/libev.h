@@ -8,4 +8,5 @@
 #define EV_USE_REALTIME 0
 #endif
 
+#include "probes.h"
 #include "../libev/ev.h"
@@ -1,5 +1,37 @@
 void Init_Scheduler();
+void Init_Allocator(void);
+void Init_Splice(void);
+void Init_FileIO(void);
+void Init_Cork(void);
+void Init_Select(void);
+void Init_Channel(void);
+void Init_Semaphore(void);
+void Init_RateLimiter(void);
+void Init_CancelScope(void);
+void Init_TaskGroup(void);
+void Init_Embed(void);
+void Init_Signals(void);
+void Init_FileWatch(void);
+void Init_Periodic(void);
+void Init_Idle(void);
+void Init_StallDetector(void);
 
 void Init_libev_scheduler_ext(void) {
   Init_Scheduler();
+  Init_Allocator();
+  Init_Splice();
+  Init_FileIO();
+  Init_Cork();
+  Init_Select();
+  Init_Channel();
+  Init_Semaphore();
+  Init_RateLimiter();
+  Init_CancelScope();
+  Init_TaskGroup();
+  Init_Embed();
+  Init_Signals();
+  Init_FileWatch();
+  Init_Periodic();
+  Init_Idle();
+  Init_StallDetector();
 }
@@ -0,0 +1,134 @@
+#include <math.h>
+#include "scheduler.h"
+#include "ruby/fiber/scheduler.h"
+
+// Wall clock timers, using ev_periodic. A periodic timer fires at absolute
+// times (offset + n * interval), recalculated by libev from the wall clock
+// after each tick, so a ticker does not drift however long each tick takes,
+// and stays aligned to interval boundaries. The same watcher is kept for all
+// ticks of a ticker.
+
+struct periodic_watch {
+  struct ev_periodic periodic;
+  Scheduler_t *scheduler;
+  VALUE fiber;
+  int waiting; // fiber is suspended waiting for a tick
+  int ticked;  // tick not yet consumed
+};
+
+static void periodic_watch_callback(EV_P_ ev_periodic *w, int revents) {
+  struct periodic_watch *watch = (struct periodic_watch *)w;
+  watch->ticked = 1;
+  if (watch->waiting) {
+    watch->waiting = 0;
+    SCHEDULE(watch->scheduler, watch->fiber);
+  }
+}
+
+static Scheduler_t *periodic_scheduler(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  if (waiter_current_scheduler(rb_fiber_scheduler_current()) != scheduler)
+    rb_raise(rb_eRuntimeError, "must be called from a fiber running on this scheduler");
+  return scheduler;
+}
+
+static void periodic_watch_init(struct periodic_watch *watch, Scheduler_t *scheduler, double offset, double interval) {
+  watch->scheduler = scheduler;
+  watch->fiber = rb_fiber_current();
+  watch->waiting = 0;
+  watch->ticked = 0;
+  ev_periodic_init(&watch->periodic, periodic_watch_callback, offset, interval, 0);
+}
+
+// Waits for the next tick, unless one occurred since the last wait
+static void periodic_watch_wait(struct periodic_watch *watch) {
+  if (!watch->ticked) {
+    watch->waiting = 1;
+    watch->scheduler->pending_count++;
+    int state;
+    VALUE ret = YIELD(&state);
+    watch->scheduler->pending_count--;
+    if (watch->waiting)
+      // resumed by an exception, before being woken
+      watch->waiting = 0;
+    else if (state || RESUMED_WITH_EXCEPTION(ret))
+      runqueue_delete(&watch->scheduler->runqueue, watch->fiber);
+    RAISE_IF_EXCEPTION(state, ret);
+  }
+  watch->ticked = 0;
+}
+
+static VALUE periodic_wait(VALUE arg) {
+  periodic_watch_wait((struct periodic_watch *)arg);
+  return Qnil;
+}
+
+static VALUE periodic_watch_stop(VALUE arg) {
+  struct periodic_watch *watch = (struct periodic_watch *)arg;
+  ev_periodic_stop(watch->scheduler->ev_loop, &watch->periodic);
+  return Qnil;
+}
+
+// Sleeps until the given wall clock time (a Time, or seconds since the epoch).
+// Unlike sleeping for a duration, the wake up time follows changes to the
+// system clock.
+VALUE Scheduler_sleep_until(VALUE self, VALUE time) {
+  Scheduler_t *scheduler = periodic_scheduler(self);
+  double at = NUM2DBL(rb_Float(time));
+
+  struct periodic_watch watch;
+  periodic_watch_init(&watch, scheduler, at, 0.);
+  ev_periodic_start(scheduler->ev_loop, &watch.periodic);
+  rb_ensure(periodic_wait, (VALUE)&watch, periodic_watch_stop, (VALUE)&watch);
+  RB_GC_GUARD(watch.fiber);
+  return Qnil;
+}
+
+static VALUE periodic_loop(VALUE arg) {
+  struct periodic_watch *watch = (struct periodic_watch *)arg;
+  while (1) {
+    periodic_watch_wait(watch);
+    rb_yield(Qnil);
+  }
+  return Qnil;
+}
+
+// every(interval, offset: 0) { ... }
+//
+// Calls the given block at each wall clock time that is a multiple of the
+// interval (in seconds) plus the offset, e.g. every(60, offset: 5) runs at 5
+// seconds past each minute. Ticks missed while the block is running are
+// coalesced into a single call. Runs until the block breaks (or raises).
+VALUE Scheduler_every(int argc, VALUE *argv, VALUE self) {
+  VALUE interval_value, opts;
+  VALUE offset_value = Qundef;
+  static ID ID_offset;
+  if (!ID_offset) ID_offset = rb_intern("offset");
+
+  rb_scan_args(argc, argv, "1:", &interval_value, &opts);
+  rb_need_block();
+  if (!NIL_P(opts)) rb_get_kwargs(opts, &ID_offset, 0, 1, &offset_value);
+  double interval = NUM2DBL(interval_value);
+  if (!(interval > 0)) rb_raise(rb_eArgError, "interval must be positive");
+  double offset = (offset_value == Qundef || NIL_P(offset_value)) ? 0 : NUM2DBL(offset_value);
+  offset = fmod(offset, interval);
+  if (offset < 0) offset += interval;
+  Scheduler_t *scheduler = periodic_scheduler(self);
+
+  struct periodic_watch watch;
+  periodic_watch_init(&watch, scheduler, offset, interval);
+  ev_periodic_start(scheduler->ev_loop, &watch.periodic);
+  VALUE ret = rb_ensure(periodic_loop, (VALUE)&watch, periodic_watch_stop, (VALUE)&watch);
+  RB_GC_GUARD(watch.fiber);
+  return ret;
+}
+
+void Init_Periodic(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  VALUE cScheduler = rb_const_get(mLibev, rb_intern("Scheduler"));
+
+  rb_define_method(cScheduler, "sleep_until", Scheduler_sleep_until, 1);
+  rb_define_method(cScheduler, "every", Scheduler_every, -1);
+}
@@ -0,0 +1,28 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// Static (USDT) tracepoints, usable with bpftrace, perf or systemtap, e.g.:
+//
+//   bpftrace -e 'usdt:./libev_scheduler_ext.so:libev_scheduler:poll__return { @[arg0] = count(); }'
+//
+// The probes are compiled out when sys/sdt.h is not available. When compiled
+// in, an unattached probe costs a single nop instruction.
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE0(name)              DTRACE_PROBE(libev_scheduler, name)
+#define PROBE1(name, a)           DTRACE_PROBE1(libev_scheduler, name, a)
+#define PROBE2(name, a, b)        DTRACE_PROBE2(libev_scheduler, name, a, b)
+#define PROBE3(name, a, b, c)     DTRACE_PROBE3(libev_scheduler, name, a, b, c)
+#else
+#define PROBE0(name)              (void)0
+#define PROBE1(name, a)           (void)0
+#define PROBE2(name, a, b)        (void)0
+#define PROBE3(name, a, b, c)     (void)0
+#endif
+
+// timeout is given in µs
+#define EV_PROBE_BACKEND_POLL_ENTRY(timeout) PROBE1(backend_poll__entry, (long)((timeout) * 1e6))
+#define EV_PROBE_BACKEND_POLL_RETURN(res)    PROBE1(backend_poll__return, (int)(res))
+
+#endif /* PROBES_H */
@@ -0,0 +1,174 @@
+#include "scheduler.h"
+#include "ruby/fiber/scheduler.h"
+
+// A token bucket rate limiter. The bucket holds up to burst tokens, and is
+// refilled continuously at the given rate (computed lazily from the elapsed
+// time). Fibers waiting for a token are kept in FIFO order, and are served by a
+// single refill timer per limiter, which is started on the loop of the fiber
+// that started waiting first, and runs only while there are waiters.
+
+typedef struct RateLimiter_t {
+  double rate;           // tokens per second
+  double burst;          // bucket capacity
+  double tokens;
+  uint64_t refilled_at;  // monotonic time (ns)
+  struct waiter_list waiters;
+  struct ev_timer timer;
+  Scheduler_t *timer_scheduler; // scheduler running the timer while active
+} RateLimiter_t;
+
+static VALUE cRateLimiter;
+
+static void RateLimiter_mark(void *ptr) {
+  RateLimiter_t *limiter = ptr;
+  waiter_list_mark(&limiter->waiters);
+}
+
+static size_t RateLimiter_size(const void *ptr) {
+  return sizeof(RateLimiter_t);
+}
+
+static const rb_data_type_t RateLimiter_type = {
+    "LibevRateLimiter",
+    {RateLimiter_mark, RUBY_TYPED_DEFAULT_FREE, RateLimiter_size,},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+#define GetRateLimiter(obj, limiter) \
+  TypedData_Get_Struct((obj), RateLimiter_t, &RateLimiter_type, (limiter))
+
+static void rate_limiter_timer_callback(EV_P_ ev_timer *w, int revents);
+
+static VALUE RateLimiter_allocate(VALUE klass) {
+  RateLimiter_t *limiter = ALLOC(RateLimiter_t);
+  limiter->rate = 1;
+  limiter->burst = 1;
+  limiter->tokens = 1;
+  limiter->refilled_at = monotonic_ns();
+  limiter->waiters = (struct waiter_list){ NULL, NULL };
+  ev_timer_init(&limiter->timer, rate_limiter_timer_callback, 0., 0.);
+  limiter->timer_scheduler = NULL;
+
+  return TypedData_Wrap_Struct(klass, &RateLimiter_type, limiter);
+}
+
+// Initializes a rate limiter allowing rate acquisitions per second on average,
+// and up to burst acquisitions at once. The bucket starts full.
+static VALUE RateLimiter_initialize(int argc, VALUE *argv, VALUE self) {
+  RateLimiter_t *limiter;
+  GetRateLimiter(self, limiter);
+  rb_check_arity(argc, 1, 2);
+
+  limiter->rate = NUM2DBL(argv[0]);
+  if (!(limiter->rate > 0)) rb_raise(rb_eArgError, "rate must be positive");
+  limiter->burst = argc == 2 ? NUM2DBL(argv[1]) : 1;
+  if (!(limiter->burst >= 1)) rb_raise(rb_eArgError, "burst must be at least 1");
+  limiter->tokens = limiter->burst;
+  limiter->refilled_at = monotonic_ns();
+  return self;
+}
+
+static void rate_limiter_refill(RateLimiter_t *limiter) {
+  uint64_t now = monotonic_ns();
+  limiter->tokens += (now - limiter->refilled_at) / 1e9 * limiter->rate;
+  if (limiter->tokens > limiter->burst) limiter->tokens = limiter->burst;
+  limiter->refilled_at = now;
+}
+
+// Hands out available tokens to waiters, in FIFO order
+static void rate_limiter_dispatch(RateLimiter_t *limiter) {
+  rate_limiter_refill(limiter);
+  while (limiter->waiters.head && limiter->tokens >= 1) {
+    limiter->tokens -= 1;
+    waiter_wake(waiter_list_shift(&limiter->waiters), WAITER_DONE);
+  }
+}
+
+// Starts the timer for when the next token becomes available. The timer counts
+// as a pending operation on its scheduler, so the loop keeps running for
+// waiters on other schedulers.
+static void rate_limiter_timer_start(RateLimiter_t *limiter, Scheduler_t *scheduler) {
+  double delay = (1 - limiter->tokens) / limiter->rate;
+  ev_timer_set(&limiter->timer, delay > 0 ? delay : 0, 0.);
+  ev_timer_start(scheduler->ev_loop, &limiter->timer);
+  scheduler->pending_count++;
+  limiter->timer_scheduler = scheduler;
+}
+
+static void rate_limiter_timer_stop(RateLimiter_t *limiter) {
+  ev_timer_stop(limiter->timer_scheduler->ev_loop, &limiter->timer);
+  limiter->timer_scheduler->pending_count--;
+}
+
+static void rate_limiter_timer_callback(EV_P_ ev_timer *w, int revents) {
+  RateLimiter_t *limiter = (RateLimiter_t *)((char *)w - offsetof(RateLimiter_t, timer));
+  Scheduler_t *scheduler = limiter->timer_scheduler;
+  scheduler->pending_count--;
+  rate_limiter_dispatch(limiter);
+  if (limiter->waiters.head) rate_limiter_timer_start(limiter, scheduler);
+}
+
+// Takes a token, waiting for one to become available if the bucket is empty.
+// Waiting must be done from a fiber running on a Libev scheduler.
+static VALUE RateLimiter_acquire(VALUE self) {
+  RateLimiter_t *limiter;
+  GetRateLimiter(self, limiter);
+
+  rate_limiter_refill(limiter);
+  if (limiter->tokens >= 1 && !limiter->waiters.head) {
+    limiter->tokens -= 1;
+    return self;
+  }
+
+  Scheduler_t *scheduler = waiter_current_scheduler(rb_fiber_scheduler_current());
+  if (!scheduler) rb_raise(rb_eRuntimeError, "must be called from a fiber running on a Libev::Scheduler");
+  if (!ev_is_active(&limiter->timer)) rate_limiter_timer_start(limiter, scheduler);
+
+  struct waiter waiter = { .blocker = self, .value = Qnil };
+  int state;
+  VALUE ret = waiter_wait(&limiter->waiters, &waiter, &state);
+  if (state || RESUMED_WITH_EXCEPTION(ret)) {
+    if (waiter.state == WAITER_DONE) {
+      // return the token handed over before the exception was raised
+      limiter->tokens += 1;
+      rate_limiter_dispatch(limiter);
+    }
+    if (!limiter->waiters.head && ev_is_active(&limiter->timer))
+      rate_limiter_timer_stop(limiter);
+    RAISE_IF_EXCEPTION(state, ret);
+  }
+  return self;
+}
+
+// Takes a token if one is available without waiting. Returns true if taken.
+static VALUE RateLimiter_try_acquire(VALUE self) {
+  RateLimiter_t *limiter;
+  GetRateLimiter(self, limiter);
+
+  rate_limiter_refill(limiter);
+  if (limiter->tokens >= 1 && !limiter->waiters.head) {
+    limiter->tokens -= 1;
+    return Qtrue;
+  }
+  return Qfalse;
+}
+
+// Returns the number of tokens currently in the bucket
+static VALUE RateLimiter_available(VALUE self) {
+  RateLimiter_t *limiter;
+  GetRateLimiter(self, limiter);
+
+  rate_limiter_refill(limiter);
+  return DBL2NUM(limiter->tokens);
+}
+
+void Init_RateLimiter(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  cRateLimiter = rb_define_class_under(mLibev, "RateLimiter", rb_cObject);
+  rb_define_alloc_func(cRateLimiter, RateLimiter_allocate);
+
+  rb_define_method(cRateLimiter, "initialize", RateLimiter_initialize, -1);
+  rb_define_method(cRateLimiter, "acquire", RateLimiter_acquire, 0);
+  rb_define_method(cRateLimiter, "try_acquire", RateLimiter_try_acquire, 0);
+  rb_define_method(cRateLimiter, "available", RateLimiter_available, 0);
+}
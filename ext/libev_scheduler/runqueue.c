@@ -0,0 +1,88 @@
+#include "runqueue.h"
+
+#define RUNQUEUE_INITIAL_SIZE 64
+
+void runqueue_initialize(runqueue_t *runqueue) {
+  runqueue->size = RUNQUEUE_INITIAL_SIZE;
+  runqueue->count = 0;
+  runqueue->head = 0;
+  runqueue->entries = ALLOC_N(runqueue_entry, runqueue->size);
+}
+
+void runqueue_finalize(runqueue_t *runqueue) {
+  xfree(runqueue->entries);
+  runqueue->entries = NULL;
+}
+
+void runqueue_mark(runqueue_t *runqueue) {
+  for (unsigned int i = 0; i < runqueue->count; i++) {
+    runqueue_entry *entry = &runqueue->entries[(runqueue->head + i) % runqueue->size];
+    rb_gc_mark(entry->fiber);
+    rb_gc_mark(entry->value);
+  }
+}
+
+static void runqueue_resize(runqueue_t *runqueue) {
+  unsigned int old_size = runqueue->size;
+  runqueue->size = old_size * 2;
+  REALLOC_N(runqueue->entries, runqueue_entry, runqueue->size);
+  // move wrapped entries into the newly added space
+  if (runqueue->head + runqueue->count > old_size) {
+    unsigned int wrapped = runqueue->head + runqueue->count - old_size;
+    MEMCPY(runqueue->entries + old_size, runqueue->entries, runqueue_entry, wrapped);
+  }
+}
+
+void runqueue_push(runqueue_t *runqueue, VALUE fiber, VALUE value, uint64_t scheduled_at) {
+  if (runqueue->count == runqueue->size) runqueue_resize(runqueue);
+
+  runqueue_entry *entry = &runqueue->entries[(runqueue->head + runqueue->count) % runqueue->size];
+  entry->fiber = fiber;
+  entry->value = value;
+  entry->scheduled_at = scheduled_at;
+  runqueue->count++;
+}
+
+// Pushes the given fibers, growing the buffer at most once
+void runqueue_push_batch(runqueue_t *runqueue, const VALUE *fibers, unsigned int count, uint64_t scheduled_at) {
+  while (runqueue->size - runqueue->count < count) runqueue_resize(runqueue);
+
+  for (unsigned int i = 0; i < count; i++) {
+    runqueue_entry *entry = &runqueue->entries[(runqueue->head + runqueue->count + i) % runqueue->size];
+    entry->fiber = fibers[i];
+    entry->value = Qnil;
+    entry->scheduled_at = scheduled_at;
+  }
+  runqueue->count += count;
+}
+
+runqueue_entry runqueue_shift(runqueue_t *runqueue) {
+  runqueue_entry entry = runqueue->entries[runqueue->head];
+  runqueue->head = (runqueue->head + 1) % runqueue->size;
+  runqueue->count--;
+  return entry;
+}
+
+static void runqueue_delete_matching(runqueue_t *runqueue, VALUE fiber, int match_value, VALUE value) {
+  unsigned int count = runqueue->count;
+  unsigned int kept = 0;
+  for (unsigned int i = 0; i < count; i++) {
+    runqueue_entry entry = runqueue->entries[(runqueue->head + i) % runqueue->size];
+    if (entry.fiber == fiber && (!match_value || entry.value == value)) continue;
+    runqueue->entries[(runqueue->head + kept) % runqueue->size] = entry;
+    kept++;
+  }
+  runqueue->count = kept;
+}
+
+// Removes all entries for the given fiber. This is O(n) and is meant to be used
+// only on exceptional paths.
+void runqueue_delete(runqueue_t *runqueue, VALUE fiber) {
+  runqueue_delete_matching(runqueue, fiber, 0, Qnil);
+}
+
+// Removes entries for the given fiber with the given resume value. Like
+// runqueue_delete, this is meant to be used only on exceptional paths.
+void runqueue_delete_value(runqueue_t *runqueue, VALUE fiber, VALUE value) {
+  runqueue_delete_matching(runqueue, fiber, 1, value);
+}
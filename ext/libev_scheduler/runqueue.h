@@ -0,0 +1,36 @@
+#ifndef RUNQUEUE_H
+#define RUNQUEUE_H
+
+#include <stdint.h>
+#include "ruby.h"
+
+typedef struct runqueue_entry {
+  VALUE fiber;
+  VALUE value;           // value the fiber is resumed with
+  uint64_t scheduled_at; // monotonic time (ns) at which the fiber became ready
+} runqueue_entry;
+
+// A growable ring buffer of fibers ready to be resumed. Pushing and shifting
+// do not allocate, except when the buffer needs to grow.
+typedef struct runqueue {
+  runqueue_entry *entries;
+  unsigned int size;
+  unsigned int count;
+  unsigned int head;
+} runqueue_t;
+
+void runqueue_initialize(runqueue_t *runqueue);
+void runqueue_finalize(runqueue_t *runqueue);
+void runqueue_mark(runqueue_t *runqueue);
+
+void runqueue_push(runqueue_t *runqueue, VALUE fiber, VALUE value, uint64_t scheduled_at);
+void runqueue_push_batch(runqueue_t *runqueue, const VALUE *fibers, unsigned int count, uint64_t scheduled_at);
+runqueue_entry runqueue_shift(runqueue_t *runqueue);
+void runqueue_delete(runqueue_t *runqueue, VALUE fiber);
+void runqueue_delete_value(runqueue_t *runqueue, VALUE fiber, VALUE value);
+
+static inline unsigned int runqueue_len(runqueue_t *runqueue) {
+  return runqueue->count;
+}
+
+#endif /* RUNQUEUE_H */
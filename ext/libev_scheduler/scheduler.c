@@ -6,11 +6,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdnoreturn.h>
+#include <sys/stat.h>
 
-#include "../libev/ev.h"
-#include "ruby.h"
-#include "ruby/io.h"
-#include "../libev/ev.h"
+#include "scheduler.h"
 
 // Some debugging facilities
 #define INSPECT(str, obj) { \
@@ -25,57 +23,151 @@
 
 ID ID_ivar_is_nonblocking;
 ID ID_ivar_io;
+ID ID_wakeup;
+ID ID_poll;
+ID ID_timer_lateness;
+ID ID_kill;
+ID ID_initialize_options[3];
+VALUE SYM_count;
+VALUE SYM_min;
+VALUE SYM_max;
+VALUE SYM_mean;
+VALUE SYM_p50;
+VALUE SYM_p90;
+VALUE SYM_p99;
+VALUE SYM_p999;
 VALUE VALUE_nil;
 
 // IO event mask (from IO::READABLE & IO::WRITEABLE)
 int event_readable;
 int event_writable;
 
-typedef struct Scheduler_t {
-  struct ev_loop *ev_loop;
-  struct ev_async break_async; // used for breaking out of blocking event loop
-
-  unsigned int pending_count;
-  unsigned int currently_polling;
-  VALUE ready_fibers;
-} Scheduler_t;
 
 static size_t Scheduler_size(const void *ptr) {
-  return sizeof(Scheduler_t);
+  const Scheduler_t *scheduler = ptr;
+  return sizeof(Scheduler_t) + scheduler->runqueue.size * sizeof(runqueue_entry);
 }
 
 static void Scheduler_mark(void *ptr) {
   Scheduler_t *scheduler = ptr;
-  rb_gc_mark(scheduler->ready_fibers);
+  runqueue_mark(&scheduler->runqueue);
+  rb_gc_mark(scheduler->current_fiber);
+  rb_gc_mark(scheduler->thread);
+  if (scheduler->trace) trace_buffer_mark(scheduler->trace);
+  for (int i = 0; i < scheduler->fd_states_size; i++)
+    if (scheduler->fd_states[i]) rb_gc_mark(scheduler->fd_states[i]->io_obj);
+  Scheduler_write_buffers_mark(scheduler);
+  if (scheduler->embedded) Scheduler_embedded_mark(scheduler);
+  if (scheduler->signal_watches) Scheduler_signals_mark(scheduler);
+  Scheduler_idle_mark(scheduler);
+}
+
+static void Scheduler_free(void *ptr) {
+  Scheduler_t *scheduler = ptr;
+  runqueue_finalize(&scheduler->runqueue);
+  if (scheduler->trace) trace_buffer_free(scheduler->trace);
+  for (int i = 0; i < scheduler->fd_states_size; i++)
+    if (scheduler->fd_states[i]) xfree(scheduler->fd_states[i]);
+  if (scheduler->fd_states) xfree(scheduler->fd_states);
+  if (scheduler->fd_kinds) xfree(scheduler->fd_kinds);
+  Scheduler_write_buffers_release(scheduler);
+  Scheduler_embedded_free(scheduler);
+  Scheduler_signals_free(scheduler);
+  pthread_mutex_destroy(&scheduler->file_io_lock);
+#ifdef HAVE_SPLICE
+  Scheduler_splice_pipes_close(scheduler);
+#endif
+  xfree(scheduler);
 }
 
-static const rb_data_type_t Scheduler_type = {
+const rb_data_type_t Scheduler_type = {
     "LibevScheduler",
-    {Scheduler_mark, 0, Scheduler_size,},
+    {Scheduler_mark, Scheduler_free, Scheduler_size,},
     0, 0, RUBY_TYPED_FREE_IMMEDIATELY
 };
 
 static VALUE Scheduler_allocate(VALUE klass) {
   Scheduler_t *scheduler = ALLOC(Scheduler_t);
+  runqueue_initialize(&scheduler->runqueue);
+  scheduler->current_fiber = Qnil;
+  scheduler->thread = Qnil;
+  scheduler->trace = NULL;
+  scheduler->fd_states = NULL;
+  scheduler->fd_states_size = 0;
+  scheduler->splice_pipe_count = 0;
+  pthread_mutex_init(&scheduler->file_io_lock, NULL);
+  scheduler->file_io_completed = NULL;
+  scheduler->fd_kinds = NULL;
+  scheduler->fd_kinds_size = 0;
+  scheduler->write_buffers = NULL;
+  scheduler->write_buffers_size = 0;
+  scheduler->dirty_write_buffers = NULL;
+  MEMZERO(scheduler->io_cache, struct io_cache_entry, IO_CACHE_SIZE);
+  scheduler->spawn_batches = NULL;
+  scheduler->embedded = NULL;
+  scheduler->embedded_in = NULL;
+  scheduler->signal_watches = NULL;
+  Scheduler_idle_init(scheduler);
 
   return TypedData_Wrap_Struct(klass, &Scheduler_type, scheduler);
 }
 
-#define GetScheduler(obj, scheduler) \
-  TypedData_Get_Struct((obj), Scheduler_t, &Scheduler_type, (scheduler))
-
 void break_async_callback(struct ev_loop *ev_loop, struct ev_async *ev_async, int revents) {
-  // This callback does nothing, the break async is used solely for breaking out
-  // of a *blocking* event loop (waking it up) in a thread-safe, signal-safe manner
+  // The break async is used for breaking out of a *blocking* event loop (waking
+  // it up) in a thread-safe, signal-safe manner. It is also signalled by the
+  // file IO worker pool on job completion.
+  Scheduler_t *scheduler = (Scheduler_t *)((char *)ev_async - offsetof(Scheduler_t, break_async));
+  Scheduler_file_io_complete(scheduler);
+}
+
+static const struct {
+  const char *name;
+  unsigned int flag;
+} backends[] = {
+  {"select",   EVBACKEND_SELECT},
+  {"poll",     EVBACKEND_POLL},
+  {"epoll",    EVBACKEND_EPOLL},
+  {"kqueue",   EVBACKEND_KQUEUE},
+  {"linuxaio", EVBACKEND_LINUXAIO},
+  {"io_uring", EVBACKEND_IOURING},
+};
+
+#define BACKEND_COUNT (sizeof(backends) / sizeof(backends[0]))
+
+static unsigned int backend_flag(VALUE name) {
+  if (NIL_P(name)) return 0;
+
+  const char *str = rb_id2name(rb_sym2id(name));
+  for (unsigned int i = 0; i < BACKEND_COUNT; i++)
+    if (!strcmp(str, backends[i].name)) return backends[i].flag;
+  rb_raise(rb_eArgError, "unknown backend %"PRIsVALUE, name);
 }
 
-static VALUE Scheduler_initialize(VALUE self) {
+// Accepts the following options: expected_fds, expected_timers, used for
+// pre-sizing the loop's internal tables, and backend, for choosing the loop's
+// backend (:epoll, :io_uring etc) instead of libev's default. On the main
+// thread, the backend can only be chosen by the first scheduler.
+static VALUE Scheduler_initialize(int argc, VALUE *argv, VALUE self) {
   Scheduler_t *scheduler;
   VALUE thread = rb_thread_current();
   int is_main_thread = (thread == rb_thread_main());
+  VALUE opts;
+  VALUE hints[3] = {Qundef, Qundef, Qundef};
+
+  rb_scan_args(argc, argv, "0:", &opts);
+  if (!NIL_P(opts)) rb_get_kwargs(opts, ID_initialize_options, 0, 3, hints);
+  unsigned int backend = hints[2] == Qundef ? 0 : backend_flag(hints[2]);
 
   GetScheduler(self, scheduler);
-  scheduler->ev_loop = is_main_thread ? EV_DEFAULT : ev_loop_new(EVFLAG_NOSIGMASK);
+  scheduler->ev_loop = is_main_thread ? ev_default_loop(backend) : ev_loop_new(EVFLAG_NOSIGMASK | backend);
+  if (!scheduler->ev_loop) rb_raise(rb_eRuntimeError, "backend not available");
+  ev_loop_reserve(
+    scheduler->ev_loop,
+    (hints[0] == Qundef || NIL_P(hints[0])) ? 0 : NUM2INT(hints[0]),
+    (hints[1] == Qundef || NIL_P(hints[1])) ? 0 : NUM2INT(hints[1])
+  );
+
+  ev_prepare_init(&scheduler->cork_prepare, NULL);
 
   ev_async_init(&scheduler->break_async, break_async_callback);
   ev_async_start(scheduler->ev_loop, &scheduler->break_async);
@@ -83,72 +175,163 @@ static VALUE Scheduler_initialize(VALUE self) {
 
   scheduler->pending_count = 0;
   scheduler->currently_polling = 0;
-  scheduler->ready_fibers = rb_ary_new();
+  scheduler->heartbeat = 0;
+  scheduler->unblock_count = 0;
+  scheduler->closed = 0;
+  scheduler->current_fiber = Qnil;
+  scheduler->thread = thread;
+
+  histogram_reset(&scheduler->wakeup_latency);
+  histogram_reset(&scheduler->poll_duration);
+  histogram_reset(&scheduler->timer_lateness);
 
   return Qnil;
 }
 
-VALUE Scheduler_poll(VALUE self);
+// Returns true while there are fibers to resume or operations pending, on the
+// scheduler or on schedulers embedded in it
+int Scheduler_has_work(Scheduler_t *scheduler) {
+  if (scheduler->pending_count > 0 || runqueue_len(&scheduler->runqueue) > 0 || scheduler->spawn_batches)
+    return 1;
+  return scheduler->embedded && Scheduler_embedded_has_work(scheduler);
+}
 
 VALUE Scheduler_run(VALUE self) {
   Scheduler_t *scheduler;
   GetScheduler(self, scheduler);
 
-  while (scheduler->pending_count > 0 || RARRAY_LEN(scheduler->ready_fibers) > 0) {
+  while (Scheduler_has_work(scheduler)) {
     Scheduler_poll(self);
   }
 
   return self;
 }
 
+static void Scheduler_fd_state_remove(Scheduler_t *scheduler, struct fd_state *state);
+
 VALUE Scheduler_close(VALUE self) {
   Scheduler_t *scheduler;
   GetScheduler(self, scheduler);
 
   Scheduler_run(self);
+  Scheduler_unembed_all(scheduler);
+  Scheduler_signals_stop(scheduler);
+  Scheduler_idle_stop(scheduler);
+
+  for (int i = 0; i < scheduler->fd_states_size; i++)
+    if (scheduler->fd_states[i]) Scheduler_fd_state_remove(scheduler, scheduler->fd_states[i]);
+  Scheduler_write_buffers_free(scheduler);
+
+#ifdef HAVE_SPLICE
+  Scheduler_splice_pipes_close(scheduler);
+#endif
 
   ev_async_stop(scheduler->ev_loop, &scheduler->break_async);
   if (!ev_is_default_loop(scheduler->ev_loop)) ev_loop_destroy(scheduler->ev_loop);
+  __atomic_store_n(&scheduler->closed, 1, __ATOMIC_RELAXED);
   return self;
 }
 
-struct libev_timer {
-  struct ev_timer timer;
-  Scheduler_t *scheduler;
-  VALUE fiber;
-};
-
-#define SCHEDULE(scheduler, fiber) rb_ary_push((scheduler)->ready_fibers, fiber)
-
 void Scheduler_timer_callback(EV_P_ ev_timer *w, int revents) {
   struct libev_timer *watcher = (struct libev_timer *)w;
-  SCHEDULE(watcher->scheduler, watcher->fiber);
+  uint64_t now = monotonic_ns();
+  histogram_record(&watcher->scheduler->timer_lateness, now > watcher->deadline ? now - watcher->deadline : 0);
+  TRACE(watcher->scheduler, TRACE_TIMER_FIRE, watcher->fiber, 0, 0);
+  runqueue_push(&watcher->scheduler->runqueue, watcher->fiber, Qnil, now);
+}
+
+void timer_watcher_init(struct libev_timer *watcher, Scheduler_t *scheduler, double duration) {
+  watcher->scheduler = scheduler;
+  watcher->fiber = rb_fiber_current();
+  watcher->deadline = monotonic_ns() + (uint64_t)(duration > 0 ? duration * 1e9 : 0);
+  ev_timer_init(&watcher->timer, Scheduler_timer_callback, duration, 0.);
+  TRACE(scheduler, TRACE_TIMER_START, watcher->fiber, 0, duration < 2147. ? (int32_t)(duration * 1e6) : INT32_MAX);
 }
 
 VALUE rb_fiber_yield_value(VALUE _value) {
   return rb_fiber_yield(1, &VALUE_nil);
 }
 
-VALUE rb_fiber_yield_rescue(VALUE _value, VALUE err) {
-  return err;
+__thread struct fiber_wait *fiber_waits __attribute__((tls_model("initial-exec"))) = NULL;
+VALUE fiber_kill_value;
+
+// Drops wakeups still queued for the fiber (e.g. by a timer that fired before
+// the exception arrived), which would otherwise resume it at a later wait,
+// then raises the exception or kills the fiber
+void fiber_wait_raise(Scheduler_t *scheduler, VALUE fiber, VALUE ret) {
+  runqueue_delete(&scheduler->runqueue, fiber);
+  if (ret == fiber_kill_value)
+    rb_funcall(fiber, ID_kill, 0);
+  else
+    rb_exc_raise(ret);
 }
 
-#define YIELD() rb_rescue2(rb_fiber_yield_value, VALUE_nil, rb_fiber_yield_rescue, VALUE_nil, rb_eException)
+static struct fiber_wait *fiber_wait_find(VALUE fiber) {
+  for (struct fiber_wait *wait = fiber_waits; wait; wait = wait->next)
+    if (wait->fiber == fiber) return wait;
+  return NULL;
+}
+
+// Queues a fiber suspended in a hot wait with the given resume value, in place
+// of any wakeup already queued for it
+static void fiber_wait_interrupt(struct fiber_wait *wait, VALUE value) {
+  runqueue_delete(&wait->scheduler->runqueue, wait->fiber);
+  SCHEDULE_VALUE(wait->scheduler, wait->fiber, value);
+}
+
+// Prepended to Fiber#raise. The exception is raised in a fiber suspended in a
+// hot wait once it is resumed by its scheduler, rather than immediately.
+static VALUE Fiber_raise(int argc, VALUE *argv, VALUE self) {
+  struct fiber_wait *wait = fiber_wait_find(self);
+  if (!wait) return rb_call_super(argc, argv);
+
+  VALUE exception = argc ? rb_make_exception(argc, argv) :
+    rb_exc_new_cstr(rb_eRuntimeError, "unhandled exception");
+  fiber_wait_interrupt(wait, exception);
+  return Qnil;
+}
+
+// Prepended to Fiber#kill, see Fiber_raise
+static VALUE Fiber_kill(VALUE self) {
+  struct fiber_wait *wait = fiber_wait_find(self);
+  if (!wait) return rb_call_super(0, NULL);
+
+  fiber_wait_interrupt(wait, fiber_kill_value);
+  return self;
+}
+
+// Puts the current fiber at the back of the run queue, letting all other ready
+// fibers run (and the loop poll for events) before it is resumed.
+VALUE Scheduler_yield(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  VALUE fiber = rb_fiber_current();
+  SCHEDULE(scheduler, fiber);
+  VALUE ret = fiber_wait_yield(scheduler, fiber);
+  RAISE_IF_INTERRUPTED(scheduler, fiber, ret);
+  RB_GC_GUARD(fiber);
+  return ret;
+}
 
 VALUE Scheduler_sleep(VALUE self, VALUE duration) {
   Scheduler_t *scheduler;
   struct libev_timer watcher;
   GetScheduler(self, scheduler);
 
-  watcher.scheduler = scheduler;
-  watcher.fiber = rb_fiber_current();
-  ev_timer_init(&watcher.timer, Scheduler_timer_callback, NUM2DBL(duration), 0.);
+  // zero-timer fast path for sleep(0) and friends
+  double seconds = NUM2DBL(duration);
+  if (seconds <= 0) return Scheduler_yield(self);
+
+  timer_watcher_init(&watcher, scheduler, seconds);
   ev_timer_start(scheduler->ev_loop, &watcher.timer);
+  PROBE1(sleep__entry, (long)(seconds * 1e6));
   scheduler->pending_count++;
-  VALUE ret = YIELD();
+  VALUE ret = fiber_wait_yield(scheduler, watcher.fiber);
   scheduler->pending_count--;
   ev_timer_stop(scheduler->ev_loop, &watcher.timer);
-  if (!NIL_P(ret)) rb_exc_raise(ret);
+  PROBE0(sleep__return);
+  RAISE_IF_INTERRUPTED(scheduler, watcher.fiber, ret);
   RB_GC_GUARD(watcher.fiber);
   RB_GC_GUARD(ret);
   return ret;
@@ -158,22 +341,35 @@ VALUE Scheduler_pause(VALUE self) {
   Scheduler_t *scheduler;
   GetScheduler(self, scheduler);
 
+  VALUE fiber = rb_fiber_current();
   ev_ref(scheduler->ev_loop);
   scheduler->pending_count++;
-  VALUE ret = YIELD();
+  VALUE ret = fiber_wait_yield(scheduler, fiber);
   scheduler->pending_count--;
   ev_unref(scheduler->ev_loop);
-  if (!NIL_P(ret)) rb_exc_raise(ret);
+  RAISE_IF_INTERRUPTED(scheduler, fiber, ret);
+  RB_GC_GUARD(fiber);
   return ret;
 }
 
 VALUE Scheduler_block(int argc, VALUE *argv, VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
   VALUE timeout = (argc == 2) ? argv[1] : Qnil;
-  if (timeout != Qnil)
-    Scheduler_sleep(self, timeout);
-  else
+  if (timeout == Qnil) {
     Scheduler_pause(self);
-  
+    return Qtrue;
+  }
+
+  unsigned long unblock_count = scheduler->unblock_count;
+  Scheduler_sleep(self, timeout);
+  // An unblock arriving before the fiber is resumed by its timeout queues it a
+  // second time (with a zero timeout, the fiber is queued right away), which
+  // would resume a later wait. The O(n) delete is skipped if no fiber was
+  // unblocked in the meantime.
+  if (scheduler->unblock_count != unblock_count)
+    runqueue_delete(&scheduler->runqueue, rb_fiber_current());
   return Qtrue;
 }
 
@@ -182,6 +378,8 @@ VALUE Scheduler_unblock(VALUE self, VALUE blocker, VALUE fiber) {
   GetScheduler(self, scheduler);
 
   SCHEDULE(scheduler, fiber);
+  scheduler->unblock_count++;
+  TRACE(scheduler, TRACE_UNBLOCK, fiber, 0, rb_thread_current() != scheduler->thread);
 
   if (scheduler->currently_polling)
     ev_async_send(scheduler->ev_loop, &scheduler->break_async);
@@ -209,112 +407,290 @@ int io_event_mask(VALUE events) {
   return mask;
 }
 
-VALUE Scheduler_io_wait(VALUE self, VALUE io, VALUE events, VALUE timeout) {
-  Scheduler_t *scheduler;
-  struct libev_io io_watcher;
+static void fd_state_wake(struct fd_state *state, struct fd_waiter *waiter, int revents) {
+  if (state->reader == waiter) state->reader = NULL;
+  if (state->writer == waiter) state->writer = NULL;
+  waiter->revents = revents;
+  SCHEDULE(state->scheduler, waiter->fiber);
+}
+
+void Scheduler_fd_state_callback(EV_P_ ev_io *w, int revents) {
+  struct fd_state *state = (struct fd_state *)w;
+  revents &= EV_READ | EV_WRITE;
+
+  // an edge delivered to a waiting fiber is consumed by it, otherwise it is
+  // cached for the next io_wait call
+  if ((revents & EV_READ) && state->reader) {
+    struct fd_waiter *reader = state->reader;
+    fd_state_wake(state, reader, revents & (reader == state->writer ? EV_READ | EV_WRITE : EV_READ));
+    revents &= ~reader->revents;
+  }
+  if ((revents & EV_WRITE) && state->writer) {
+    fd_state_wake(state, state->writer, EV_WRITE);
+    revents &= ~EV_WRITE;
+  }
+  state->ready |= revents;
+}
+
+static inline struct fd_state *Scheduler_fd_state(Scheduler_t *scheduler, int fd) {
+  return (fd < scheduler->fd_states_size) ? scheduler->fd_states[fd] : NULL;
+}
+
+static void Scheduler_fd_state_remove(Scheduler_t *scheduler, struct fd_state *state) {
+  scheduler->fd_states[state->io.fd] = NULL;
+  ev_ref(scheduler->ev_loop);
+  ev_io_stop(scheduler->ev_loop, &state->io);
+  if (state->reader) fd_state_wake(state, state->reader, 0);
+  if (state->writer) fd_state_wake(state, state->writer, 0);
+  xfree(state);
+}
+
+// Waits on an fd registered for edge-triggered notifications. Returns Qundef
+// if another fiber is already waiting on the fd for the same events.
+static VALUE Scheduler_io_wait_registered(Scheduler_t *scheduler, struct fd_state *state, int mask, VALUE timeout) {
+  int ready = state->ready & mask;
+  if (ready) {
+    state->ready &= ~ready;
+    return ev_mask_to_events(ready);
+  }
+
+  if (((mask & EV_READ) && state->reader) || ((mask & EV_WRITE) && state->writer))
+    return Qundef;
+
+  struct fd_waiter waiter = { rb_fiber_current(), 0 };
   struct libev_timer timeout_watcher;
-  GetScheduler(self, scheduler);
+  int use_timeout = timeout != Qnil;
+  int fd = state->io.fd;
 
-  rb_io_t *fptr;
-  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
-  if (underlying_io != Qnil) io = underlying_io;
-  GetOpenFile(io, fptr);
+  if (mask & EV_READ) state->reader = &waiter;
+  if (mask & EV_WRITE) state->writer = &waiter;
+  if (use_timeout) {
+    timer_watcher_init(&timeout_watcher, scheduler, NUM2DBL(timeout));
+    ev_timer_start(scheduler->ev_loop, &timeout_watcher.timer);
+  }
+
+  TRACE(scheduler, TRACE_IO_WAIT_START, waiter.fiber, mask, fd);
+  ev_ref(scheduler->ev_loop);
+  scheduler->pending_count++;
+  VALUE ret = fiber_wait_yield(scheduler, waiter.fiber);
+  scheduler->pending_count--;
+  ev_unref(scheduler->ev_loop);
+  TRACE(scheduler, TRACE_IO_WAIT_END, waiter.fiber, mask, fd);
+
+  if (use_timeout) ev_timer_stop(scheduler->ev_loop, &timeout_watcher.timer);
+  // the fd state might have been removed while waiting
+  if (Scheduler_fd_state(scheduler, fd) == state) {
+    if (state->reader == &waiter) state->reader = NULL;
+    if (state->writer == &waiter) state->writer = NULL;
+  }
+
+  RAISE_IF_INTERRUPTED(scheduler, waiter.fiber, ret);
+  RB_GC_GUARD(waiter.fiber);
+  return waiter.revents ? ev_mask_to_events(waiter.revents) : Qnil;
+}
+
+// Waits for the given fd to become ready. Returns the ready events, or nil on
+// timeout.
+VALUE Scheduler_io_wait_fd(Scheduler_t *scheduler, int fd, int mask, VALUE timeout) {
+  struct libev_io io_watcher;
+  struct libev_timer timeout_watcher;
 
   io_watcher.scheduler = scheduler;
   io_watcher.fiber = rb_fiber_current();
-  ev_io_init(&io_watcher.io, Scheduler_io_callback, fptr->fd, io_event_mask(events));
+  ev_io_init(&io_watcher.io, Scheduler_io_callback, fd, mask);
 
   int use_timeout = timeout != Qnil;
   if (use_timeout) {
-    timeout_watcher.scheduler = scheduler;
-    timeout_watcher.fiber = rb_fiber_current();
-    ev_timer_init(&timeout_watcher.timer, Scheduler_timer_callback, NUM2DBL(timeout), 0.);
+    timer_watcher_init(&timeout_watcher, scheduler, NUM2DBL(timeout));
     ev_timer_start(scheduler->ev_loop, &timeout_watcher.timer);
   }
 
   ev_io_start(scheduler->ev_loop, &io_watcher.io);
+  TRACE(scheduler, TRACE_IO_WAIT_START, io_watcher.fiber, io_watcher.io.events, io_watcher.io.fd);
+  PROBE2(io_wait__entry, io_watcher.io.fd, io_watcher.io.events);
   scheduler->pending_count++;
-  VALUE ret = YIELD();
+  VALUE ret = fiber_wait_yield(scheduler, io_watcher.fiber);
   scheduler->pending_count--;
   ev_io_stop(scheduler->ev_loop, &io_watcher.io);
+  TRACE(scheduler, TRACE_IO_WAIT_END, io_watcher.fiber, io_watcher.io.events, io_watcher.io.fd);
+  PROBE2(io_wait__return, io_watcher.io.fd, io_watcher.io.events);
   if (use_timeout)
     ev_timer_stop(scheduler->ev_loop, &timeout_watcher.timer);
 
-  if (!NIL_P(ret)) rb_exc_raise(ret);
+  RAISE_IF_INTERRUPTED(scheduler, io_watcher.fiber, ret);
 
   if (use_timeout && ev_timer_remaining(scheduler->ev_loop, &timeout_watcher.timer) <= 0)
     return VALUE_nil;
 
-  return events;
+  return ev_mask_to_events(mask);
 }
 
-struct libev_child {
-  struct ev_child child;
-  Scheduler_t *scheduler;
-  VALUE fiber;
-  VALUE status;
-};
+VALUE Scheduler_io_wait_fptr(Scheduler_t *scheduler, rb_io_t *fptr, int mask, VALUE timeout) {
+  struct fd_state *state = Scheduler_fd_state(scheduler, fptr_fd(fptr));
+  if (state) {
+    if (state->fptr == fptr) {
+      VALUE ret = Scheduler_io_wait_registered(scheduler, state, mask, timeout);
+      if (ret != Qundef) return ret;
+    }
+    else
+      // the registered IO was closed without being deregistered
+      Scheduler_fd_state_remove(scheduler, state);
+  }
 
-void Scheduler_child_callback(EV_P_ ev_child *w, int revents)
-{
-  struct libev_child *watcher = (struct libev_child *)w;
-  int exit_status = WEXITSTATUS(w->rstatus);
-  watcher->status = rb_ary_new_from_args(2, INT2NUM(w->rpid), INT2NUM(exit_status));
-  SCHEDULE(watcher->scheduler, watcher->fiber);
+  return Scheduler_io_wait_fd(scheduler, fptr_fd(fptr), mask, timeout);
+}
+
+rb_io_t *Scheduler_get_fptr(VALUE io) {
+  rb_io_t *fptr;
+  VALUE underlying_io = rb_ivar_get(io, ID_ivar_io);
+  if (underlying_io != Qnil) io = underlying_io;
+  GetOpenFile(io, fptr);
+  return fptr;
+}
+
+// Resolves the rb_io_t for the given IO, skipping the @io ivar lookup and
+// GetOpenFile for IOs seen before. Only plain IOs are cached. An entry is valid
+// as long as the object still points to the same rb_io_t with the same fd, so
+// closing or reopening the IO invalidates it, and a closed IO falls through to
+// GetOpenFile, which raises.
+rb_io_t *Scheduler_io_fptr(Scheduler_t *scheduler, VALUE io) {
+  struct io_cache_entry *entry = &scheduler->io_cache[(io >> 3) & (IO_CACHE_SIZE - 1)];
+  if (entry->io == io && RB_TYPE_P(io, T_FILE) && RFILE(io)->fptr == entry->fptr &&
+      fptr_fd(entry->fptr) == entry->fd)
+    return entry->fptr;
+
+  rb_io_t *fptr = Scheduler_get_fptr(io);
+  if (RB_TYPE_P(io, T_FILE) && RFILE(io)->fptr == fptr) {
+    entry->io = io;
+    entry->fptr = fptr;
+    entry->fd = fptr_fd(fptr);
+  }
+  return fptr;
 }
 
-VALUE Scheduler_process_wait(VALUE self, VALUE pid, VALUE flags) {
+VALUE Scheduler_io_wait(VALUE self, VALUE io, VALUE events, VALUE timeout) {
   Scheduler_t *scheduler;
-  struct libev_child watcher;
-  VALUE result = Qnil;
   GetScheduler(self, scheduler);
 
-  watcher.scheduler = scheduler;
-  watcher.fiber = rb_fiber_current();
-  watcher.status = Qnil;
-  ev_child_init(&watcher.child, Scheduler_child_callback, NUM2INT(pid), 0);
-  ev_child_start(scheduler->ev_loop, &watcher.child);
-  scheduler->pending_count++;
-  rb_fiber_yield(1, &VALUE_nil);
-  scheduler->pending_count--;
-  ev_child_stop(scheduler->ev_loop, &watcher.child);
-  RB_GC_GUARD(watcher.status);
-  RB_GC_GUARD(result);
-  return result;
+  rb_io_t *fptr = Scheduler_io_fptr(scheduler, io);
+  return Scheduler_io_wait_fptr(scheduler, fptr, io_event_mask(events), timeout);
 }
 
 void Scheduler_resume_ready(Scheduler_t *scheduler) {
-  VALUE ready_fibers = Qnil;
-
-  unsigned int ready_count = RARRAY_LEN(scheduler->ready_fibers);
-  while (ready_count > 0) {
-    ready_fibers = scheduler->ready_fibers;
-    scheduler->ready_fibers = rb_ary_new();
+  // Only fibers that are ready at this point are resumed, fibers scheduled in
+  // the meantime are left for the next iteration, so a fiber repeatedly
+  // yielding cannot starve the event loop. Resumed fibers may delete stale
+  // entries, so the queue can run out before the count does.
+  unsigned int ready_count = runqueue_len(&scheduler->runqueue);
+  while (ready_count-- > 0 && runqueue_len(&scheduler->runqueue)) {
+    runqueue_entry entry = runqueue_shift(&scheduler->runqueue);
+    uint64_t now = monotonic_ns();
+    uint64_t latency = now > entry.scheduled_at ? now - entry.scheduled_at : 0;
+    histogram_record(&scheduler->wakeup_latency, latency);
+    PROBE2(fiber__resume, entry.fiber, latency);
+    scheduler->current_fiber = entry.fiber;
+    TRACE(scheduler, TRACE_FIBER_RESUME, entry.fiber, 0, 0);
+    rb_fiber_resume(entry.fiber, 1, &entry.value);
+    TRACE(scheduler, TRACE_FIBER_YIELD, entry.fiber, 0, 0);
+    scheduler->current_fiber = Qnil;
+    scheduler->heartbeat++;
+    RB_GC_GUARD(entry.fiber);
+  }
+}
 
-    for (unsigned int i = 0; i < ready_count; i++) {
-      VALUE fiber = RARRAY_AREF(ready_fibers, i);
-      rb_fiber_resume(fiber, 1, &VALUE_nil);
-    }
+// Runs a single iteration of the event loop, processing I/O and timers
+static void Scheduler_poll_loop(Scheduler_t *scheduler, int flags) {
+  // flush trace events between iterations, so the buffer rarely fills up and
+  // events are rarely dropped
+  if (scheduler->trace && scheduler->trace->count >= scheduler->trace->size / 2)
+    trace_buffer_flush(scheduler->trace);
 
-    ready_count = RARRAY_LEN(scheduler->ready_fibers);
-  }
+  scheduler->currently_polling = 1;
+  if (scheduler->embedded) Scheduler_embedded_set_polling(scheduler, 1);
+  TRACE(scheduler, TRACE_POLL_ENTER, Qnil, 0, 0);
+  PROBE1(poll__entry, scheduler->pending_count);
+  uint64_t poll_start = monotonic_ns();
+  ev_run(scheduler->ev_loop, flags);
+  uint64_t poll_duration = monotonic_ns() - poll_start;
+  histogram_record(&scheduler->poll_duration, poll_duration);
+  PROBE2(poll__return, runqueue_len(&scheduler->runqueue), poll_duration);
+  TRACE(scheduler, TRACE_POLL_EXIT, Qnil, 0, runqueue_len(&scheduler->runqueue));
+  if (scheduler->embedded) Scheduler_embedded_set_polling(scheduler, 0);
+  scheduler->currently_polling = 0;
+  scheduler->heartbeat++;
+}
 
-  RB_GC_GUARD(ready_fibers);
+static void Scheduler_resume_all_ready(Scheduler_t *scheduler) {
+  Scheduler_resume_ready(scheduler);
+  if (scheduler->embedded) Scheduler_embedded_resume(scheduler);
 }
 
 VALUE Scheduler_poll(VALUE self) {
   Scheduler_t *scheduler;
   GetScheduler(self, scheduler);
 
-  scheduler->currently_polling = 1;
-  ev_run(scheduler->ev_loop, EVRUN_ONCE);
-  scheduler->currently_polling = 0;
+  if (scheduler->spawn_batches) Scheduler_flush_spawn_batches(scheduler);
 
-  Scheduler_resume_ready(scheduler);
+  unsigned int ready_count = runqueue_len(&scheduler->runqueue);
+  if (scheduler->embedded) ready_count += Scheduler_embedded_ready(scheduler);
+  // while fibers are ready, the loop is still polled (without blocking) on
+  // each pass, so I/O and timers are not delayed by yielding fibers
+  Scheduler_poll_loop(scheduler, ready_count ? EVRUN_NOWAIT : EVRUN_ONCE);
+  Scheduler_resume_all_ready(scheduler);
+
+  return self;
+}
+
+// Runs a single iteration of the event loop without blocking, then resumes
+// ready fibers. Meant for driving the scheduler from a host event loop
+// watching its backend fd (see #backend_fd and #next_timeout). Must be called
+// from outside the scheduler's fibers.
+VALUE Scheduler_run_nowait(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  if (scheduler->spawn_batches) Scheduler_flush_spawn_batches(scheduler);
+  Scheduler_poll_loop(scheduler, EVRUN_NOWAIT);
+  Scheduler_resume_all_ready(scheduler);
 
   return self;
 }
 
+// Returns the name of the loop's backend
+VALUE Scheduler_backend(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  unsigned int backend = ev_backend(scheduler->ev_loop);
+  for (unsigned int i = 0; i < BACKEND_COUNT; i++)
+    if (backends[i].flag == backend) return ID2SYM(rb_intern(backends[i].name));
+  return Qnil;
+}
+
+// Returns the fd of the loop's backend (e.g. the epoll fd), which becomes
+// readable when the loop has events to process, or nil if the backend has no
+// fd.
+VALUE Scheduler_backend_fd(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  int fd = ev_loop_backend_fd(scheduler->ev_loop);
+  return fd >= 0 ? INT2NUM(fd) : Qnil;
+}
+
+// Returns the maximum time (in seconds) a host loop can wait on the backend fd
+// before calling #run_nowait: 0 if fibers are ready, the time until the next
+// timer, or nil if no timer is running.
+VALUE Scheduler_next_timeout(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  if (runqueue_len(&scheduler->runqueue) || scheduler->spawn_batches) return DBL2NUM(0.);
+  if (scheduler->embedded && Scheduler_embedded_ready(scheduler)) return DBL2NUM(0.);
+  ev_tstamp timeout = ev_loop_next_timeout(scheduler->ev_loop);
+  return timeout >= 0 ? DBL2NUM(timeout) : Qnil;
+}
+
 VALUE Scheduler_pending_count(VALUE self) {
   Scheduler_t *scheduler;
   GetScheduler(self, scheduler);
@@ -322,30 +698,279 @@ VALUE Scheduler_pending_count(VALUE self) {
   return INT2NUM(scheduler->pending_count);
 }
 
-void Init_Scheduler() {
-  ev_set_allocator(xrealloc);
+// Registers the given IO for edge-triggered readiness notifications. This is
+// meant for sockets and pipes owned by the scheduler long-term, which are
+// always read/written until EAGAIN. Returns false if the backend does not
+// support edge-triggered notifications (only epoll does), or if the IO is a
+// regular file.
+VALUE Scheduler_register_io(VALUE self, VALUE io) {
+  Scheduler_t *scheduler;
+  struct stat st;
+  GetScheduler(self, scheduler);
+
+  rb_io_t *fptr = Scheduler_get_fptr(io);
+  int fd = fptr_fd(fptr);
+
+  if (ev_backend(scheduler->ev_loop) != EVBACKEND_EPOLL) return Qfalse;
+  if (fstat(fd, &st) || S_ISREG(st.st_mode)) return Qfalse;
+
+  struct fd_state *state = Scheduler_fd_state(scheduler, fd);
+  if (state) {
+    if (state->fptr == fptr) return Qtrue;
+    Scheduler_fd_state_remove(scheduler, state);
+  }
+
+  if (fd >= scheduler->fd_states_size) {
+    int size = scheduler->fd_states_size ? scheduler->fd_states_size : 64;
+    while (size <= fd) size *= 2;
+    REALLOC_N(scheduler->fd_states, struct fd_state *, size);
+    MEMZERO(scheduler->fd_states + scheduler->fd_states_size, struct fd_state *, size - scheduler->fd_states_size);
+    scheduler->fd_states_size = size;
+  }
+
+  state = ALLOC(struct fd_state);
+  state->scheduler = scheduler;
+  state->io_obj = io;
+  state->fptr = fptr;
+  state->ready = 0;
+  state->reader = NULL;
+  state->writer = NULL;
+  ev_io_init(&state->io, Scheduler_fd_state_callback, fd, EV_READ | EV_WRITE | EV_ET);
+  ev_io_start(scheduler->ev_loop, &state->io);
+  ev_unref(scheduler->ev_loop); // don't count the persistent watcher
+  scheduler->fd_states[fd] = state;
+
+  return Qtrue;
+}
+
+// Deregisters the given IO. This should be called before the IO is closed.
+VALUE Scheduler_deregister_io(VALUE self, VALUE io) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  rb_io_t *fptr = Scheduler_get_fptr(io);
+  struct fd_state *state = Scheduler_fd_state(scheduler, fptr_fd(fptr));
+  if (!state) return Qfalse;
+
+  Scheduler_fd_state_remove(scheduler, state);
+  return Qtrue;
+}
+
+VALUE Scheduler_heartbeat(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  return ULONG2NUM(scheduler->heartbeat);
+}
+
+VALUE Scheduler_polling_p(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  return scheduler->currently_polling ? Qtrue : Qfalse;
+}
+
+VALUE Scheduler_current_fiber(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  return scheduler->current_fiber;
+}
+
+#define TRACE_DEFAULT_BUFFER_SIZE 4096
+#define TRACE_DEFAULT_MAX_OUTPUT (64 * 1024 * 1024)
+
+// Starts recording trace events into a buffer of the given size (in events).
+// Output accumulated between calls to #flush_trace is capped at max_output
+// bytes. Events not fitting in the buffer or the output are dropped, and
+// counted (see #trace_dropped).
+VALUE Scheduler_start_tracing(int argc, VALUE *argv, VALUE self) {
+  Scheduler_t *scheduler;
+  VALUE size, max_output;
+  GetScheduler(self, scheduler);
+
+  rb_scan_args(argc, argv, "02", &size, &max_output);
+  if (scheduler->trace) return self;
+
+  unsigned int buffer_size = NIL_P(size) ? TRACE_DEFAULT_BUFFER_SIZE : NUM2UINT(size);
+  if (buffer_size < 2) rb_raise(rb_eArgError, "trace buffer size must be at least 2");
+  size_t max_bytes = NIL_P(max_output) ? TRACE_DEFAULT_MAX_OUTPUT : NUM2SIZET(max_output);
+  scheduler->trace = trace_buffer_new(buffer_size, max_bytes);
+  return self;
+}
+
+VALUE Scheduler_flush_trace(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  if (!scheduler->trace) return Qnil;
+
+  trace_buffer_flush(scheduler->trace);
+  VALUE output = scheduler->trace->output;
+  scheduler->trace->output = rb_str_buf_new(0);
+  return output;
+}
+
+VALUE Scheduler_stop_tracing(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  VALUE output = Scheduler_flush_trace(self);
+  if (scheduler->trace) {
+    trace_buffer_free(scheduler->trace);
+    scheduler->trace = NULL;
+  }
+  return output;
+}
+
+// Returns the number of trace events dropped since tracing was started
+VALUE Scheduler_trace_dropped(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  return scheduler->trace ? ULONG2NUM(scheduler->trace->dropped) : Qnil;
+}
+
+VALUE Scheduler_tracing_p(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  return scheduler->trace ? Qtrue : Qfalse;
+}
+
+static histogram_t *Scheduler_histogram(Scheduler_t *scheduler, VALUE kind) {
+  ID id = rb_sym2id(kind);
+  if (id == ID_wakeup)          return &scheduler->wakeup_latency;
+  if (id == ID_poll)            return &scheduler->poll_duration;
+  if (id == ID_timer_lateness)  return &scheduler->timer_lateness;
+
+  rb_raise(rb_eArgError, "invalid latency histogram kind %"PRIsVALUE, kind);
+}
 
+#define NS_TO_SEC(ns) DBL2NUM((double)(ns) / 1e9)
+
+static VALUE histogram_to_hash(histogram_t *histogram) {
+  VALUE hash = rb_hash_new();
+  rb_hash_aset(hash, SYM_count, ULL2NUM(histogram->count));
+  rb_hash_aset(hash, SYM_min,   NS_TO_SEC(histogram->count ? histogram->min : 0));
+  rb_hash_aset(hash, SYM_max,   NS_TO_SEC(histogram->max));
+  rb_hash_aset(hash, SYM_mean,  NS_TO_SEC(histogram->count ? histogram->sum / histogram->count : 0));
+  rb_hash_aset(hash, SYM_p50,   NS_TO_SEC(histogram_percentile(histogram, 50)));
+  rb_hash_aset(hash, SYM_p90,   NS_TO_SEC(histogram_percentile(histogram, 90)));
+  rb_hash_aset(hash, SYM_p99,   NS_TO_SEC(histogram_percentile(histogram, 99)));
+  rb_hash_aset(hash, SYM_p999,  NS_TO_SEC(histogram_percentile(histogram, 99.9)));
+  return hash;
+}
+
+VALUE Scheduler_latency_stats(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  VALUE stats = rb_hash_new();
+  rb_hash_aset(stats, ID2SYM(ID_wakeup),          histogram_to_hash(&scheduler->wakeup_latency));
+  rb_hash_aset(stats, ID2SYM(ID_poll),            histogram_to_hash(&scheduler->poll_duration));
+  rb_hash_aset(stats, ID2SYM(ID_timer_lateness),  histogram_to_hash(&scheduler->timer_lateness));
+  return stats;
+}
+
+VALUE Scheduler_latency_percentile(VALUE self, VALUE kind, VALUE percentile) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  histogram_t *histogram = Scheduler_histogram(scheduler, kind);
+  return NS_TO_SEC(histogram_percentile(histogram, NUM2DBL(percentile)));
+}
+
+VALUE Scheduler_reset_latency_stats(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  histogram_reset(&scheduler->wakeup_latency);
+  histogram_reset(&scheduler->poll_duration);
+  histogram_reset(&scheduler->timer_lateness);
+  return self;
+}
+
+// Releases memory held by the loop's internal tables beyond what is currently
+// in use, e.g. after a traffic spike.
+VALUE Scheduler_shrink(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  ev_loop_shrink(scheduler->ev_loop);
+  return self;
+}
+
+void Init_Scheduler() {
   VALUE mLibev = rb_define_module("Libev");
   VALUE cScheduler = rb_define_class_under(mLibev, "Scheduler", rb_cObject);
   rb_define_alloc_func(cScheduler, Scheduler_allocate);
 
-  rb_define_method(cScheduler, "initialize", Scheduler_initialize, 0);
+  rb_define_method(cScheduler, "initialize", Scheduler_initialize, -1);
 
   // fiber scheduler interface
   rb_define_method(cScheduler, "close", Scheduler_close, 0);
   rb_define_method(cScheduler, "io_wait", Scheduler_io_wait, 3);
-  rb_define_method(cScheduler, "process_wait", Scheduler_process_wait, 2);
   rb_define_method(cScheduler, "block", Scheduler_block, -1);
   rb_define_method(cScheduler, "unblock", Scheduler_unblock, 2);
 
   rb_define_method(cScheduler, "run", Scheduler_run, 0);
+  rb_define_method(cScheduler, "yield", Scheduler_yield, 0);
+  rb_define_method(cScheduler, "run_nowait", Scheduler_run_nowait, 0);
+  rb_define_method(cScheduler, "backend", Scheduler_backend, 0);
+  rb_define_method(cScheduler, "backend_fd", Scheduler_backend_fd, 0);
+  rb_define_method(cScheduler, "next_timeout", Scheduler_next_timeout, 0);
+  rb_define_method(cScheduler, "register_io", Scheduler_register_io, 1);
+  rb_define_method(cScheduler, "deregister_io", Scheduler_deregister_io, 1);
   rb_define_method(cScheduler, "pending_count", Scheduler_pending_count, 0);
 
+  // stall detection
+  rb_define_method(cScheduler, "heartbeat", Scheduler_heartbeat, 0);
+  rb_define_method(cScheduler, "polling?", Scheduler_polling_p, 0);
+  rb_define_method(cScheduler, "current_fiber", Scheduler_current_fiber, 0);
+
+  // tracing
+  rb_define_method(cScheduler, "start_tracing", Scheduler_start_tracing, -1);
+  rb_define_method(cScheduler, "stop_tracing", Scheduler_stop_tracing, 0);
+  rb_define_method(cScheduler, "flush_trace", Scheduler_flush_trace, 0);
+  rb_define_method(cScheduler, "trace_dropped", Scheduler_trace_dropped, 0);
+  rb_define_method(cScheduler, "tracing?", Scheduler_tracing_p, 0);
+
+  // latency histograms
+  rb_define_method(cScheduler, "latency_stats", Scheduler_latency_stats, 0);
+  rb_define_method(cScheduler, "latency_percentile", Scheduler_latency_percentile, 2);
+  rb_define_method(cScheduler, "reset_latency_stats", Scheduler_reset_latency_stats, 0);
+  rb_define_method(cScheduler, "shrink", Scheduler_shrink, 0);
+
   ID_ivar_is_nonblocking = rb_intern("@is_nonblocking");
   ID_ivar_io             = rb_intern("@io");
+  ID_wakeup              = rb_intern("wakeup");
+  ID_poll                = rb_intern("poll");
+  ID_timer_lateness      = rb_intern("timer_lateness");
+  ID_kill                = rb_intern("kill");
+  ID_initialize_options[0] = rb_intern("expected_fds");
+  ID_initialize_options[1] = rb_intern("expected_timers");
+  ID_initialize_options[2] = rb_intern("backend");
   VALUE_nil              = Qnil;
   rb_global_variable(&VALUE_nil);
 
+  SYM_count = ID2SYM(rb_intern("count"));
+  SYM_min   = ID2SYM(rb_intern("min"));
+  SYM_max   = ID2SYM(rb_intern("max"));
+  SYM_mean  = ID2SYM(rb_intern("mean"));
+  SYM_p50   = ID2SYM(rb_intern("p50"));
+  SYM_p90   = ID2SYM(rb_intern("p90"));
+  SYM_p99   = ID2SYM(rb_intern("p99"));
+  SYM_p999  = ID2SYM(rb_intern("p999"));
+
   event_readable = NUM2INT(rb_const_get(rb_cIO, rb_intern("READABLE")));
   event_writable = NUM2INT(rb_const_get(rb_cIO, rb_intern("WRITABLE")));
+
+  // Fiber#raise and Fiber#kill on fibers suspended in hot waits
+  fiber_kill_value = rb_obj_freeze(rb_obj_alloc(rb_cObject));
+  rb_gc_register_mark_object(fiber_kill_value);
+  VALUE mFiberInterrupt = rb_define_module_under(mLibev, "FiberInterrupt");
+  rb_define_method(mFiberInterrupt, "raise", Fiber_raise, -1);
+  rb_define_method(mFiberInterrupt, "kill", Fiber_kill, 0);
+  rb_prepend_module(rb_const_get(rb_cObject, rb_intern("Fiber")), mFiberInterrupt);
 }
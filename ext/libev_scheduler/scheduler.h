@@ -0,0 +1,276 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "ruby.h"
+#include "ruby/io.h"
+#include <pthread.h>
+#include "../libev/ev.h"
+#include "histogram.h"
+#include "runqueue.h"
+#include "waiter.h"
+#include "trace.h"
+#include "probes.h"
+
+extern ID ID_ivar_io;
+extern VALUE VALUE_nil;
+
+// IO event mask (from IO::READABLE & IO::WRITEABLE)
+extern int event_readable;
+extern int event_writable;
+
+struct fd_waiter {
+  VALUE fiber;
+  int revents;
+};
+
+// State of an fd registered for edge-triggered notifications. A single
+// persistent watcher is kept for the fd, and readiness reported by the backend
+// is cached until consumed by io_wait.
+struct fd_state {
+  struct ev_io io;
+  struct Scheduler_t *scheduler;
+  VALUE io_obj;
+  rb_io_t *fptr;
+  unsigned char ready;          // cached readiness (EV_READ | EV_WRITE)
+  struct fd_waiter *reader;
+  struct fd_waiter *writer;
+};
+
+#define SPLICE_PIPE_POOL_SIZE 8
+
+struct file_io_job;
+struct write_buffer;
+struct task_group;
+struct embedded_loop;
+struct signal_watch;
+
+// Cached classification of an fd, validated against the owning IO object, its
+// rb_io_t and fd (like io_cache entries). FD_KIND_NONBLOCK is not cached, as
+// the fd's flags can be changed at any time.
+#define FD_KIND_KNOWN    1
+#define FD_KIND_REGULAR  2
+#define FD_KIND_NONBLOCK 4
+
+struct fd_kind {
+  VALUE io;
+  rb_io_t *fptr;
+  unsigned char kind;
+};
+
+// Entry in the cache of IO objects resolved by the io hooks, see
+// Scheduler_io_fptr
+#define IO_CACHE_SIZE 256
+
+struct io_cache_entry {
+  VALUE io;
+  rb_io_t *fptr;
+  int fd;
+};
+
+typedef struct Scheduler_t {
+  struct ev_loop *ev_loop;
+  struct ev_async break_async; // used for breaking out of blocking event loop
+
+  unsigned int pending_count;
+  unsigned int currently_polling;
+  unsigned long unblock_count; // used for dropping duplicate wakeups, see Scheduler_block
+  runqueue_t runqueue;
+
+  // updated after each fiber resume and each poll, used for stall detection
+  unsigned long heartbeat;
+  unsigned int closed;
+  VALUE current_fiber;
+  VALUE thread;
+
+  trace_buffer *trace; // NULL unless tracing is enabled
+
+  // edge-triggered fd registrations, indexed by fd
+  struct fd_state **fd_states;
+  int fd_states_size;
+
+  // idle pipes used for splicing
+  int splice_pipes[SPLICE_PIPE_POOL_SIZE][2];
+  int splice_pipe_count;
+
+  // file IO jobs completed by the worker pool, protected by file_io_lock
+  pthread_mutex_t file_io_lock;
+  struct file_io_job *file_io_completed;
+
+  // write coalescing buffers for corked IOs, indexed by fd
+  struct write_buffer **write_buffers;
+  int write_buffers_size;
+  struct write_buffer *dirty_write_buffers;
+  struct ev_prepare cork_prepare;
+
+  // fd classification cache for the io_read/io_write hooks, indexed by fd
+  struct fd_kind *fd_kinds;
+  int fd_kinds_size;
+
+  // resolved IOs, direct-mapped by object address. Entries are not marked,
+  // and are validated on each lookup
+  struct io_cache_entry io_cache[IO_CACHE_SIZE];
+
+  // task groups with fibers spawned since the last scheduling point
+  struct task_group *spawn_batches;
+
+  // loops of other schedulers embedded in this one's loop, and the embedding
+  // of this scheduler's loop in another one (see embed.c)
+  struct embedded_loop *embedded;
+  struct embedded_loop *embedded_in;
+
+  // signals watched on the loop (see signals.c)
+  struct signal_watch *signal_watches;
+
+  // fibers waiting for the loop to be idle (see idle.c)
+  struct ev_idle idle;
+  struct waiter_list idle_waiters;
+
+  // latency histograms (values in ns)
+  histogram_t wakeup_latency; // from SCHEDULE to fiber resume
+  histogram_t poll_duration;  // duration of ev_run
+  histogram_t timer_lateness; // timer firing time vs. deadline
+} Scheduler_t;
+
+extern const rb_data_type_t Scheduler_type;
+
+// defined in libev.c, which has access to the loop's internals
+void ev_loop_reserve(struct ev_loop *loop, int expected_fds, int expected_timers);
+void ev_loop_shrink(struct ev_loop *loop);
+ev_tstamp ev_loop_next_timeout(struct ev_loop *loop);
+int ev_loop_backend_fd(struct ev_loop *loop);
+
+#define GetScheduler(obj, scheduler) \
+  TypedData_Get_Struct((obj), Scheduler_t, &Scheduler_type, (scheduler))
+
+// Returns the fd of a resolved rb_io_t. Direct access to rb_io_t's fd member is
+// deprecated in favour of rb_io_descriptor, which takes the IO object and
+// checks it again, so code working on an rb_io_t reads the fd here.
+static inline int fptr_fd(rb_io_t *fptr) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  return fptr->fd;
+#pragma GCC diagnostic pop
+}
+
+#define TRACE(scheduler, type, fiber, events, arg) \
+  if ((scheduler)->trace) trace_record((scheduler)->trace, monotonic_ns(), type, fiber, events, arg)
+
+#define SCHEDULE(scheduler, fiber) runqueue_push(&(scheduler)->runqueue, fiber, Qnil, monotonic_ns())
+
+// Schedules the fiber to be resumed with the given value. Passing an exception
+// makes the fiber raise it once it has cleaned up after its wait.
+#define SCHEDULE_VALUE(scheduler, fiber, value) runqueue_push(&(scheduler)->runqueue, fiber, value, monotonic_ns())
+
+struct libev_timer {
+  struct ev_timer timer;
+  Scheduler_t *scheduler;
+  VALUE fiber;
+  uint64_t deadline; // monotonic time (ns), used for measuring lateness
+};
+
+void timer_watcher_init(struct libev_timer *watcher, Scheduler_t *scheduler, double duration);
+
+VALUE rb_fiber_yield_value(VALUE _value);
+
+// Suspends the current fiber, returning the value it is resumed with. An
+// exception raised into the fiber while suspended (Fiber#raise, Fiber#kill)
+// is caught, and its tag state stored in *state, so the caller can stop its
+// watchers before calling RAISE_IF_EXCEPTION.
+#define YIELD(state) rb_protect(rb_fiber_yield_value, Qnil, (state))
+
+#define RESUMED_WITH_EXCEPTION(ret) (RB_TYPE_P((ret), T_OBJECT) && rb_obj_is_kind_of((ret), rb_eException))
+
+// Re-raises an exception caught by YIELD, or passed as the resume value.
+#define RAISE_IF_EXCEPTION(state, ret) { \
+  if (state) rb_jump_tag(state); \
+  if (RESUMED_WITH_EXCEPTION(ret)) rb_exc_raise(ret); \
+}
+
+// A fiber suspended in one of the hot waits (sleep, block, yield and io_wait),
+// which do not set up a tag frame. These waits are registered in a per-thread
+// list. Fiber#raise and Fiber#kill on a registered fiber do not unwind it from
+// inside the wait; the fiber is instead queued with the exception (or
+// fiber_kill_value) as its resume value, so that the wait can stop its
+// watchers before raising (see RAISE_IF_INTERRUPTED).
+struct fiber_wait {
+  Scheduler_t *scheduler;
+  VALUE fiber;
+  struct fiber_wait *prev;
+  struct fiber_wait *next;
+};
+
+// initial-exec, so accessing the list does not go through __tls_get_addr
+extern __thread struct fiber_wait *fiber_waits __attribute__((tls_model("initial-exec")));
+extern VALUE fiber_kill_value;
+
+// Suspends the current fiber in a hot wait, returning the value it is resumed
+// with
+static inline VALUE fiber_wait_yield(Scheduler_t *scheduler, VALUE fiber) {
+  struct fiber_wait wait = { scheduler, fiber, NULL, fiber_waits };
+  if (wait.next) wait.next->prev = &wait;
+  fiber_waits = &wait;
+
+  VALUE ret = rb_fiber_yield(1, &VALUE_nil);
+
+  if (wait.prev) wait.prev->next = wait.next; else fiber_waits = wait.next;
+  if (wait.next) wait.next->prev = wait.prev;
+  return ret;
+}
+
+#define RESUMED_WITH_INTERRUPT(ret) ((ret) == fiber_kill_value || RESUMED_WITH_EXCEPTION(ret))
+
+void fiber_wait_raise(Scheduler_t *scheduler, VALUE fiber, VALUE ret);
+
+// Raises the exception a hot wait was resumed with, or kills the fiber. Should
+// be called once the wait's watchers are stopped.
+#define RAISE_IF_INTERRUPTED(scheduler, fiber, ret) { \
+  if (RESUMED_WITH_INTERRUPT(ret)) fiber_wait_raise(scheduler, fiber, ret); \
+}
+
+static inline VALUE ev_mask_to_events(int mask) {
+  int events = 0;
+  if (mask & EV_READ) events |= event_readable;
+  if (mask & EV_WRITE) events |= event_writable;
+  return INT2NUM(events);
+}
+
+rb_io_t *Scheduler_get_fptr(VALUE io);
+rb_io_t *Scheduler_io_fptr(Scheduler_t *scheduler, VALUE io);
+VALUE Scheduler_io_wait_fd(Scheduler_t *scheduler, int fd, int mask, VALUE timeout);
+VALUE Scheduler_io_wait_fptr(Scheduler_t *scheduler, rb_io_t *fptr, int mask, VALUE timeout);
+
+VALUE Scheduler_poll(VALUE self);
+
+void Scheduler_file_io_complete(Scheduler_t *scheduler);
+
+void Scheduler_flush_spawn_batches(Scheduler_t *scheduler);
+
+void Scheduler_resume_ready(Scheduler_t *scheduler);
+int Scheduler_has_work(Scheduler_t *scheduler);
+
+int Scheduler_embedded_has_work(Scheduler_t *scheduler);
+unsigned int Scheduler_embedded_ready(Scheduler_t *scheduler);
+void Scheduler_embedded_set_polling(Scheduler_t *scheduler, unsigned int polling);
+void Scheduler_embedded_resume(Scheduler_t *scheduler);
+void Scheduler_embedded_mark(Scheduler_t *scheduler);
+void Scheduler_embedded_free(Scheduler_t *scheduler);
+void Scheduler_unembed_all(Scheduler_t *scheduler);
+
+void Scheduler_signals_mark(Scheduler_t *scheduler);
+void Scheduler_signals_stop(Scheduler_t *scheduler);
+void Scheduler_signals_free(Scheduler_t *scheduler);
+
+void Scheduler_idle_init(Scheduler_t *scheduler);
+void Scheduler_idle_mark(Scheduler_t *scheduler);
+void Scheduler_idle_stop(Scheduler_t *scheduler);
+
+int Scheduler_corked_write(Scheduler_t *scheduler, rb_io_t *fptr, const char *base, size_t size, ssize_t *result);
+void Scheduler_write_buffers_mark(Scheduler_t *scheduler);
+void Scheduler_write_buffers_free(Scheduler_t *scheduler);
+void Scheduler_write_buffers_release(Scheduler_t *scheduler);
+
+#ifdef HAVE_SPLICE
+void Scheduler_splice_pipes_close(Scheduler_t *scheduler);
+#endif
+
+#endif /* SCHEDULER_H */
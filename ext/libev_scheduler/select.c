@@ -0,0 +1,197 @@
+#include "scheduler.h"
+#include <errno.h>
+#include <poll.h>
+
+// io_select hook. Readiness is first checked with a single non-blocking
+// poll(2), so an IO.select on IOs that are already ready (or with a zero
+// timeout) never touches the loop. Otherwise a watcher is started for each IO
+// and the fiber yields once, until any of them fires or the timeout elapses.
+//
+// libev has no event for exceptional conditions (priority data), so IOs in the
+// error set are only checked by the non-blocking poll, before waiting and after
+// wakeup.
+
+enum select_set { SELECT_READ, SELECT_WRITE, SELECT_ERROR };
+
+struct select_state {
+  Scheduler_t *scheduler;
+  VALUE fiber;
+  int woken;
+  struct ev_timer timer;
+};
+
+struct select_entry {
+  struct ev_io io;
+  struct select_state *state;
+  VALUE obj; // the IO as passed to IO.select
+  enum select_set set;
+  int ready;
+};
+
+static void select_wake(struct select_state *state) {
+  if (state->woken) return;
+  state->woken = 1;
+  SCHEDULE(state->scheduler, state->fiber);
+}
+
+static void select_io_callback(EV_P_ ev_io *w, int revents) {
+  struct select_entry *entry = (struct select_entry *)w;
+  entry->ready = 1;
+  select_wake(entry->state);
+}
+
+static void select_timer_callback(EV_P_ ev_timer *w, int revents) {
+  select_wake((struct select_state *)((char *)w - offsetof(struct select_state, timer)));
+}
+
+static int select_set_count(VALUE set) {
+  return NIL_P(set) ? 0 : (int)RARRAY_LEN(set);
+}
+
+// Fills in entries for the given set. Returns the number of entries ready
+// without polling, i.e. readables with data in their read buffer.
+static int select_entries_init(Scheduler_t *scheduler, struct select_entry *entries, struct pollfd *fds, VALUE set, enum select_set which) {
+  static const short poll_events[] = { POLLIN, POLLOUT, POLLPRI };
+  int count = select_set_count(set);
+  int pending = 0;
+
+  for (int i = 0; i < count; i++) {
+    VALUE obj = RARRAY_AREF(set, i);
+    VALUE io = rb_io_get_io(obj);
+    if (which == SELECT_WRITE) io = rb_io_get_write_io(io);
+    rb_io_t *fptr = Scheduler_io_fptr(scheduler, io);
+
+    entries[i].obj = obj;
+    entries[i].set = which;
+    entries[i].ready = (which == SELECT_READ && rb_io_read_pending(fptr));
+    pending += entries[i].ready;
+    fds[i].fd = fptr_fd(fptr);
+    fds[i].events = poll_events[which];
+    fds[i].revents = 0;
+  }
+  return pending;
+}
+
+// Checks readiness of the given entries without blocking. Returns the number of
+// ready entries.
+static int select_poll(struct select_entry *entries, struct pollfd *fds, int count) {
+  int ret;
+  do {
+    ret = poll(fds, count, 0);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) rb_sys_fail("poll");
+
+  int ready = 0;
+  for (int i = 0; i < count; i++) {
+    short revents = fds[i].revents;
+    switch (entries[i].set) {
+      case SELECT_READ:  if (revents & (POLLIN | POLLHUP | POLLERR)) entries[i].ready = 1; break;
+      case SELECT_WRITE: if (revents & (POLLOUT | POLLHUP | POLLERR)) entries[i].ready = 1; break;
+      case SELECT_ERROR: if (revents & POLLPRI) entries[i].ready = 1; break;
+    }
+    ready += entries[i].ready;
+  }
+  return ready;
+}
+
+static VALUE select_result(struct select_entry *entries, int count) {
+  VALUE sets[3] = { rb_ary_new(), rb_ary_new(), rb_ary_new() };
+  for (int i = 0; i < count; i++)
+    if (entries[i].ready) rb_ary_push(sets[entries[i].set], entries[i].obj);
+  return rb_ary_new_from_values(3, sets);
+}
+
+// io_select(readables[, writables[, exceptables[, timeout]]]) fiber scheduler
+// hook, called with the arguments given to IO.select. Returns an array of ready
+// IOs for each set, or nil on timeout.
+VALUE Scheduler_io_select(int argc, VALUE *argv, VALUE self) {
+  Scheduler_t *scheduler;
+  VALUE readables, writables, exceptables, timeout;
+  GetScheduler(self, scheduler);
+  rb_scan_args(argc, argv, "13", &readables, &writables, &exceptables, &timeout);
+
+  if (!NIL_P(readables)) Check_Type(readables, T_ARRAY);
+  if (!NIL_P(writables)) Check_Type(writables, T_ARRAY);
+  if (!NIL_P(exceptables)) Check_Type(exceptables, T_ARRAY);
+  double duration = -1; // no timeout
+  if (!NIL_P(timeout)) {
+    duration = NUM2DBL(timeout);
+    if (duration < 0) duration = 0;
+  }
+
+  int read_count = select_set_count(readables);
+  int write_count = select_set_count(writables);
+  int error_count = select_set_count(exceptables);
+  int count = read_count + write_count + error_count;
+
+  VALUE entries_buf, fds_buf;
+  struct select_entry *entries = ALLOCV_N(struct select_entry, entries_buf, count);
+  struct pollfd *fds = ALLOCV_N(struct pollfd, fds_buf, count);
+
+  int ready = select_entries_init(scheduler, entries, fds, readables, SELECT_READ);
+  ready += select_entries_init(scheduler, entries + read_count, fds + read_count, writables, SELECT_WRITE);
+  ready += select_entries_init(scheduler, entries + read_count + write_count, fds + read_count + write_count, exceptables, SELECT_ERROR);
+  if (!ready) ready = select_poll(entries, fds, count);
+
+  if (!ready && duration != 0) {
+    struct select_state state = {
+      .scheduler = scheduler,
+      .fiber = rb_fiber_current(),
+      .woken = 0
+    };
+
+    for (int i = 0; i < read_count + write_count; i++) {
+      entries[i].state = &state;
+      ev_io_init(&entries[i].io, select_io_callback, fds[i].fd, entries[i].set == SELECT_READ ? EV_READ : EV_WRITE);
+      ev_io_start(scheduler->ev_loop, &entries[i].io);
+    }
+    if (duration > 0) {
+      ev_timer_init(&state.timer, select_timer_callback, duration, 0.);
+      ev_timer_start(scheduler->ev_loop, &state.timer);
+    }
+    else if (!(read_count + write_count))
+      // only exceptables and no timeout, keep the loop alive
+      ev_ref(scheduler->ev_loop);
+
+    scheduler->pending_count++;
+    int yield_state;
+    VALUE ret = YIELD(&yield_state);
+    scheduler->pending_count--;
+
+    for (int i = 0; i < read_count + write_count; i++)
+      ev_io_stop(scheduler->ev_loop, &entries[i].io);
+    if (duration > 0)
+      ev_timer_stop(scheduler->ev_loop, &state.timer);
+    else if (!(read_count + write_count))
+      ev_unref(scheduler->ev_loop);
+
+    if (yield_state || RESUMED_WITH_EXCEPTION(ret)) {
+      if (state.woken) runqueue_delete(&scheduler->runqueue, state.fiber);
+      ALLOCV_END(entries_buf);
+      ALLOCV_END(fds_buf);
+      RAISE_IF_EXCEPTION(yield_state, ret);
+    }
+    RB_GC_GUARD(state.fiber);
+
+    for (int i = 0; i < count; i++) ready += entries[i].ready;
+    if (error_count) {
+      int offset = read_count + write_count;
+      ready += select_poll(entries + offset, fds + offset, error_count);
+    }
+  }
+
+  VALUE result = ready ? select_result(entries, count) : Qnil;
+  ALLOCV_END(entries_buf);
+  ALLOCV_END(fds_buf);
+  RB_GC_GUARD(readables);
+  RB_GC_GUARD(writables);
+  RB_GC_GUARD(exceptables);
+  return result;
+}
+
+void Init_Select(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  VALUE cScheduler = rb_const_get(mLibev, rb_intern("Scheduler"));
+
+  rb_define_method(cScheduler, "io_select", Scheduler_io_select, -1);
+}
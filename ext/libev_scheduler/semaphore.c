@@ -0,0 +1,123 @@
+#include "scheduler.h"
+
+// A counting semaphore. Permits released while fibers are waiting are handed
+// directly to the first waiter, so waiters acquire in FIFO order and a fiber
+// calling acquire cannot barge in ahead of them.
+
+typedef struct Semaphore_t {
+  long permits;
+  struct waiter_list waiters;
+} Semaphore_t;
+
+static VALUE cSemaphore;
+
+static void Semaphore_mark(void *ptr) {
+  Semaphore_t *semaphore = ptr;
+  waiter_list_mark(&semaphore->waiters);
+}
+
+static size_t Semaphore_size(const void *ptr) {
+  return sizeof(Semaphore_t);
+}
+
+static const rb_data_type_t Semaphore_type = {
+    "LibevSemaphore",
+    {Semaphore_mark, RUBY_TYPED_DEFAULT_FREE, Semaphore_size,},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+#define GetSemaphore(obj, semaphore) \
+  TypedData_Get_Struct((obj), Semaphore_t, &Semaphore_type, (semaphore))
+
+static VALUE Semaphore_allocate(VALUE klass) {
+  Semaphore_t *semaphore = ALLOC(Semaphore_t);
+  semaphore->permits = 0;
+  semaphore->waiters = (struct waiter_list){ NULL, NULL };
+
+  return TypedData_Wrap_Struct(klass, &Semaphore_type, semaphore);
+}
+
+static VALUE Semaphore_initialize(VALUE self, VALUE permits) {
+  Semaphore_t *semaphore;
+  GetSemaphore(self, semaphore);
+
+  semaphore->permits = NUM2LONG(permits);
+  if (semaphore->permits < 0) rb_raise(rb_eArgError, "permits must not be negative");
+  return self;
+}
+
+static void semaphore_release(Semaphore_t *semaphore) {
+  struct waiter *waiter = waiter_list_shift(&semaphore->waiters);
+  if (waiter)
+    waiter_wake(waiter, WAITER_DONE);
+  else
+    semaphore->permits++;
+}
+
+// Acquires a permit, waiting for one to be released if none is available
+static VALUE Semaphore_acquire(VALUE self) {
+  Semaphore_t *semaphore;
+  GetSemaphore(self, semaphore);
+
+  if (semaphore->permits > 0 && !semaphore->waiters.head) {
+    semaphore->permits--;
+    return self;
+  }
+
+  struct waiter waiter = { .blocker = self, .value = Qnil };
+  int state;
+  VALUE ret = waiter_wait(&semaphore->waiters, &waiter, &state);
+  if (state || RESUMED_WITH_EXCEPTION(ret)) {
+    // pass on a permit handed over before the exception was raised
+    if (waiter.state == WAITER_DONE) semaphore_release(semaphore);
+    RAISE_IF_EXCEPTION(state, ret);
+  }
+  return self;
+}
+
+// Acquires a permit if one is available without waiting. Returns true if
+// acquired.
+static VALUE Semaphore_try_acquire(VALUE self) {
+  Semaphore_t *semaphore;
+  GetSemaphore(self, semaphore);
+
+  if (semaphore->permits > 0 && !semaphore->waiters.head) {
+    semaphore->permits--;
+    return Qtrue;
+  }
+  return Qfalse;
+}
+
+static VALUE Semaphore_release(VALUE self) {
+  Semaphore_t *semaphore;
+  GetSemaphore(self, semaphore);
+
+  semaphore_release(semaphore);
+  return self;
+}
+
+// Runs the given block holding a permit
+static VALUE Semaphore_synchronize(VALUE self) {
+  Semaphore_acquire(self);
+  return rb_ensure(rb_yield, Qnil, Semaphore_release, self);
+}
+
+static VALUE Semaphore_available(VALUE self) {
+  Semaphore_t *semaphore;
+  GetSemaphore(self, semaphore);
+
+  return LONG2NUM(semaphore->permits);
+}
+
+void Init_Semaphore(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  cSemaphore = rb_define_class_under(mLibev, "Semaphore", rb_cObject);
+  rb_define_alloc_func(cSemaphore, Semaphore_allocate);
+
+  rb_define_method(cSemaphore, "initialize", Semaphore_initialize, 1);
+  rb_define_method(cSemaphore, "acquire", Semaphore_acquire, 0);
+  rb_define_method(cSemaphore, "try_acquire", Semaphore_try_acquire, 0);
+  rb_define_method(cSemaphore, "release", Semaphore_release, 0);
+  rb_define_method(cSemaphore, "synchronize", Semaphore_synchronize, 0);
+  rb_define_method(cSemaphore, "available", Semaphore_available, 0);
+}
@@ -0,0 +1,261 @@
+#include <signal.h>
+#include "scheduler.h"
+#include "ruby/fiber/scheduler.h"
+
+// Signal handling on the event loop. A signal trapped or waited for on a
+// scheduler is watched with an ev_signal on its loop, so its delivery is
+// processed as a normal loop event: trap handlers are run in new fibers, and
+// fibers waiting for the signal are resumed, without going through Ruby's
+// signal handling thread.
+//
+// libev's signalfd mode requires the signal to be blocked in all threads,
+// which cannot be arranged in a Ruby process, so libev's own signal handler is
+// used. It replaces the signal's current disposition (usually Ruby's handler)
+// from the first trap or wait_signal until untrap (or close), after which the
+// previous disposition is restored. A signal can only be watched by one
+// scheduler at a time.
+//
+// Schedulers on different threads (or Ractors) share the table of watched
+// signals, as well as the signal dispositions and libev's own signal table.
+// These are only changed while holding signal_watches_lock, which is never
+// held across a call that can raise or run GC.
+
+struct signal_watch {
+  struct ev_signal signal;
+  Scheduler_t *scheduler;
+  VALUE scheduler_obj;
+  VALUE handler;               // trap handler, or nil
+  struct waiter_list waiters;  // fibers waiting in wait_signal
+  int pending;                 // delivered with no trap and no waiting fiber
+  struct sigaction saved;      // disposition replaced by libev's handler
+  struct signal_watch *next;
+};
+
+// watched signals, by signal number, for all schedulers
+static struct signal_watch *signal_watches[NSIG];
+static pthread_mutex_t signal_watches_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static VALUE mSignal;
+static ID ID_list;
+static ID ID_fiber;
+
+void Scheduler_signals_mark(Scheduler_t *scheduler) {
+  for (struct signal_watch *watch = scheduler->signal_watches; watch; watch = watch->next) {
+    rb_gc_mark(watch->handler);
+    waiter_list_mark(&watch->waiters);
+  }
+}
+
+// Stops watching the signal. Fibers waiting for it return nil.
+static void signal_watch_stop(struct signal_watch *watch) {
+  int signum = watch->signal.signum;
+  Scheduler_t *scheduler = watch->scheduler;
+
+  struct waiter *waiter;
+  while ((waiter = waiter_list_shift(&watch->waiters))) waiter_wake(waiter, WAITER_CLOSED);
+
+  // ev_signal_stop resets the disposition to SIG_DFL, so the signal is
+  // blocked (at least on this thread) until the previous one is restored
+  sigset_t mask, old_mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, signum);
+  pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+  pthread_mutex_lock(&signal_watches_lock);
+  ev_ref(scheduler->ev_loop);
+  ev_signal_stop(scheduler->ev_loop, &watch->signal);
+  sigaction(signum, &watch->saved, NULL);
+  signal_watches[signum] = NULL;
+  pthread_mutex_unlock(&signal_watches_lock);
+  pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+  struct signal_watch **ptr = &scheduler->signal_watches;
+  while (*ptr != watch) ptr = &(*ptr)->next;
+  *ptr = watch->next;
+  xfree(watch);
+}
+
+// Stops watching signals, restoring their previous dispositions. Called on
+// close.
+void Scheduler_signals_stop(Scheduler_t *scheduler) {
+  while (scheduler->signal_watches) signal_watch_stop(scheduler->signal_watches);
+}
+
+// Called when the scheduler is collected without being closed
+void Scheduler_signals_free(Scheduler_t *scheduler) {
+  while (scheduler->signal_watches) {
+    struct signal_watch *watch = scheduler->signal_watches;
+    scheduler->signal_watches = watch->next;
+    pthread_mutex_lock(&signal_watches_lock);
+    sigaction(watch->signal.signum, &watch->saved, NULL);
+    signal_watches[watch->signal.signum] = NULL;
+    pthread_mutex_unlock(&signal_watches_lock);
+    xfree(watch);
+  }
+}
+
+static VALUE signal_trap_fiber(VALUE arg) {
+  VALUE *args = (VALUE *)arg;
+  return rb_funcall_with_block(args[0], ID_fiber, 0, NULL, args[1]);
+}
+
+static VALUE signal_handler_call(RB_BLOCK_CALL_FUNC_ARGLIST(_value, args)) {
+  VALUE signo = RARRAY_AREF(args, 1);
+  return rb_proc_call_with_block(RARRAY_AREF(args, 0), 1, &signo, Qnil);
+}
+
+static void signal_watch_callback(EV_P_ ev_signal *w, int revents) {
+  struct signal_watch *watch = (struct signal_watch *)w;
+  VALUE signo = INT2NUM(w->signum);
+
+  if (!watch->waiters.head && NIL_P(watch->handler)) {
+    // kept for the next wait_signal
+    watch->pending = 1;
+    return;
+  }
+
+  struct waiter *waiter;
+  while ((waiter = waiter_list_shift(&watch->waiters))) {
+    waiter->value = signo;
+    waiter_wake(waiter, WAITER_DONE);
+  }
+
+  if (!NIL_P(watch->handler)) {
+    // the handler is run in a new fiber (created with Scheduler#fiber, which
+    // schedules it). An error creating it must not unwind through the loop.
+    VALUE proc = rb_proc_new(signal_handler_call, rb_ary_new_from_args(2, watch->handler, signo));
+    VALUE args[2] = { watch->scheduler_obj, proc };
+    int state;
+    rb_protect(signal_trap_fiber, (VALUE)args, &state);
+    if (state) rb_set_errinfo(Qnil);
+    RB_GC_GUARD(proc);
+  }
+}
+
+// Converts a signal given as an integer, or as a name (with or without the SIG
+// prefix), to its number
+static int signal_number(VALUE sig) {
+  if (RB_INTEGER_TYPE_P(sig)) {
+    int signum = NUM2INT(sig);
+    if (signum <= 0 || signum >= NSIG) rb_raise(rb_eArgError, "invalid signal number (%d)", signum);
+    return signum;
+  }
+
+  VALUE name = rb_str_dup(rb_sym2str(SYMBOL_P(sig) ? sig : rb_str_intern(StringValue(sig))));
+  if (!strncmp(RSTRING_PTR(name), "SIG", 3)) name = rb_str_substr(name, 3, RSTRING_LEN(name) - 3);
+  VALUE signum = rb_hash_aref(rb_funcall(mSignal, ID_list, 0), name);
+  if (NIL_P(signum)) rb_raise(rb_eArgError, "unsupported signal '%"PRIsVALUE"'", sig);
+  return NUM2INT(signum);
+}
+
+// Starts watching the signal with the given (newly allocated) watch. Must be
+// called while holding signal_watches_lock.
+static void signal_watch_start(struct signal_watch *watch, VALUE self, Scheduler_t *scheduler, int signum) {
+  watch->scheduler = scheduler;
+  watch->scheduler_obj = self;
+  watch->handler = Qnil;
+  watch->waiters = (struct waiter_list){ NULL, NULL };
+  watch->pending = 0;
+  sigaction(signum, NULL, &watch->saved);
+
+  ev_signal_init(&watch->signal, signal_watch_callback, signum);
+  ev_signal_start(scheduler->ev_loop, &watch->signal);
+  ev_unref(scheduler->ev_loop); // a trap alone does not keep the loop running
+
+  watch->next = scheduler->signal_watches;
+  scheduler->signal_watches = watch;
+  signal_watches[signum] = watch;
+}
+
+static struct signal_watch *signal_watch_get(VALUE self, Scheduler_t *scheduler, int signum) {
+  struct signal_watch *watch = NULL;
+  while (1) {
+    pthread_mutex_lock(&signal_watches_lock);
+    struct signal_watch *current = signal_watches[signum];
+    if (!current && watch) {
+      signal_watch_start(watch, self, scheduler, signum);
+      current = watch;
+      watch = NULL;
+    }
+    Scheduler_t *owner = current ? current->scheduler : NULL;
+    pthread_mutex_unlock(&signal_watches_lock);
+
+    if (current) {
+      if (watch) xfree(watch);
+      if (owner != scheduler)
+        rb_raise(rb_eArgError, "signal %d is watched by another scheduler", signum);
+      return current;
+    }
+    // allocated outside the lock, since allocating can run GC, which can free
+    // other schedulers' watches
+    watch = ALLOC(struct signal_watch);
+  }
+}
+
+// Traps the given signal. On each delivery, the given block is called with the
+// signal number, in a new fiber. Replaces a previous trap for the signal.
+VALUE Scheduler_trap(VALUE self, VALUE sig) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+  rb_need_block();
+
+  int signum = signal_number(sig);
+  struct signal_watch *watch = signal_watch_get(self, scheduler, signum);
+  watch->handler = rb_block_proc();
+  return self;
+}
+
+// Stops watching the given signal, removing its trap and restoring its previous
+// disposition. Fibers waiting for the signal return nil.
+VALUE Scheduler_untrap(VALUE self, VALUE sig) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  int signum = signal_number(sig);
+  pthread_mutex_lock(&signal_watches_lock);
+  struct signal_watch *watch = signal_watches[signum];
+  int owned = watch && watch->scheduler == scheduler;
+  pthread_mutex_unlock(&signal_watches_lock);
+  if (!owned) return self;
+
+  signal_watch_stop(watch);
+  return self;
+}
+
+// Waits for the given signal to be delivered, returning its number. The signal
+// remains watched after returning, so a signal delivered before the next call
+// (while no fiber is waiting) is not lost: the next call returns immediately.
+// Must be called from a fiber running on this scheduler.
+VALUE Scheduler_wait_signal(VALUE self, VALUE sig) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  if (waiter_current_scheduler(rb_fiber_scheduler_current()) != scheduler)
+    rb_raise(rb_eRuntimeError, "must be called from a fiber running on this scheduler");
+
+  int signum = signal_number(sig);
+  struct signal_watch *watch = signal_watch_get(self, scheduler, signum);
+  if (watch->pending) {
+    watch->pending = 0;
+    return INT2NUM(signum);
+  }
+
+  struct waiter waiter = { .blocker = self, .value = Qnil };
+  int state;
+  VALUE ret = waiter_wait(&watch->waiters, &waiter, &state);
+  RAISE_IF_EXCEPTION(state, ret);
+  return waiter.value;
+}
+
+void Init_Signals(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  VALUE cScheduler = rb_const_get(mLibev, rb_intern("Scheduler"));
+
+  mSignal = rb_const_get(rb_cObject, rb_intern("Signal"));
+  rb_gc_register_mark_object(mSignal);
+  ID_list = rb_intern("list");
+  ID_fiber = rb_intern("fiber");
+
+  rb_define_method(cScheduler, "trap", Scheduler_trap, 1);
+  rb_define_method(cScheduler, "untrap", Scheduler_untrap, 1);
+  rb_define_method(cScheduler, "wait_signal", Scheduler_wait_signal, 1);
+}
@@ -0,0 +1,165 @@
+#include "scheduler.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+// Zero-copy transfer of data between IOs. Data is moved by the kernel, using
+// splice(2) through an internal pipe pair, or sendfile(2), and never enters the
+// Ruby heap. On EAGAIN, the current fiber waits for the relevant IO to become
+// ready using the scheduler's io_wait machinery.
+
+#ifdef HAVE_SPLICE
+
+static int splice_pipe_acquire(Scheduler_t *scheduler, int *fds) {
+  if (scheduler->splice_pipe_count > 0) {
+    int *pooled = scheduler->splice_pipes[--scheduler->splice_pipe_count];
+    fds[0] = pooled[0];
+    fds[1] = pooled[1];
+    return 0;
+  }
+  return pipe2(fds, O_CLOEXEC | O_NONBLOCK);
+}
+
+static void splice_pipe_release(Scheduler_t *scheduler, int *fds, int dirty) {
+  // a pipe still holding data (e.g. after an exception) cannot be reused
+  if (dirty || scheduler->splice_pipe_count == SPLICE_PIPE_POOL_SIZE) {
+    close(fds[0]);
+    close(fds[1]);
+    return;
+  }
+  int *pooled = scheduler->splice_pipes[scheduler->splice_pipe_count++];
+  pooled[0] = fds[0];
+  pooled[1] = fds[1];
+}
+
+void Scheduler_splice_pipes_close(Scheduler_t *scheduler) {
+  while (scheduler->splice_pipe_count > 0) {
+    int *pooled = scheduler->splice_pipes[--scheduler->splice_pipe_count];
+    close(pooled[0]);
+    close(pooled[1]);
+  }
+}
+
+struct splice_ctx {
+  Scheduler_t *scheduler;
+  rb_io_t *src;
+  rb_io_t *dest;
+  int pipefd[2];
+  size_t maxlen;
+  ssize_t pending; // bytes held in the pipe
+};
+
+static VALUE splice_body(VALUE arg) {
+  struct splice_ctx *ctx = (struct splice_ctx *)arg;
+  ssize_t len;
+
+  while (1) {
+    len = splice(fptr_fd(ctx->src), NULL, ctx->pipefd[1], NULL, ctx->maxlen, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (len >= 0) break;
+    if (errno != EAGAIN) rb_syserr_fail(errno, "splice");
+    Scheduler_io_wait_fptr(ctx->scheduler, ctx->src, EV_READ, Qnil);
+  }
+
+  ctx->pending = len;
+  while (ctx->pending > 0) {
+    ssize_t written = splice(ctx->pipefd[0], NULL, fptr_fd(ctx->dest), NULL, ctx->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (written >= 0) {
+      ctx->pending -= written;
+      continue;
+    }
+    if (errno != EAGAIN) rb_syserr_fail(errno, "splice");
+    Scheduler_io_wait_fptr(ctx->scheduler, ctx->dest, EV_WRITE, Qnil);
+  }
+
+  return SSIZET2NUM(len);
+}
+
+static VALUE splice_ensure(VALUE arg) {
+  struct splice_ctx *ctx = (struct splice_ctx *)arg;
+  splice_pipe_release(ctx->scheduler, ctx->pipefd, ctx->pending != 0);
+  return Qnil;
+}
+
+// Moves up to maxlen bytes from src to dest. Returns the number of bytes
+// moved, or 0 when src is at EOF.
+VALUE Scheduler_splice(VALUE self, VALUE src, VALUE dest, VALUE maxlen) {
+  struct splice_ctx ctx;
+  GetScheduler(self, ctx.scheduler);
+
+  ctx.src = Scheduler_get_fptr(src);
+  ctx.dest = Scheduler_get_fptr(dest);
+  rb_io_check_readable(ctx.src);
+  rb_io_check_writable(ctx.dest);
+  if (rb_io_read_pending(ctx.src))
+    rb_raise(rb_eIOError, "cannot splice from IO with buffered read data");
+  rb_io_flush(dest);
+
+  ctx.maxlen = NUM2SIZET(maxlen);
+  // a result of 0 means EOF
+  if (ctx.maxlen == 0) rb_raise(rb_eArgError, "maxlen must be positive");
+  ctx.pending = 0;
+  if (splice_pipe_acquire(ctx.scheduler, ctx.pipefd)) rb_syserr_fail(errno, "pipe2");
+
+  return rb_ensure(splice_body, (VALUE)&ctx, splice_ensure, (VALUE)&ctx);
+}
+
+#endif /* HAVE_SPLICE */
+
+#ifdef HAVE_SENDFILE
+
+// Sends len bytes from the given file, starting at offset, to the given socket
+// (if len is nil, the rest of the file is sent). Returns the number of bytes
+// sent.
+VALUE Scheduler_sendfile(VALUE self, VALUE file, VALUE socket, VALUE offset, VALUE len) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  rb_io_t *src = Scheduler_get_fptr(file);
+  rb_io_t *dest = Scheduler_get_fptr(socket);
+  rb_io_check_readable(src);
+  rb_io_check_writable(dest);
+  rb_io_flush(socket);
+
+  off_t pos = NUM2OFFT(offset);
+  size_t left;
+  if (NIL_P(len)) {
+    struct stat st;
+    if (fstat(fptr_fd(src), &st)) rb_syserr_fail(errno, "fstat");
+    left = st.st_size > pos ? st.st_size - pos : 0;
+  }
+  else
+    left = NUM2SIZET(len);
+
+  size_t total = 0;
+  while (left > 0) {
+    ssize_t sent = sendfile(fptr_fd(dest), fptr_fd(src), &pos, left);
+    if (sent > 0) {
+      total += sent;
+      left -= sent;
+      continue;
+    }
+    if (sent == 0) break; // EOF
+    if (errno != EAGAIN) rb_syserr_fail(errno, "sendfile");
+    Scheduler_io_wait_fptr(scheduler, dest, EV_WRITE, Qnil);
+  }
+
+  return SIZET2NUM(total);
+}
+
+#endif /* HAVE_SENDFILE */
+
+void Init_Splice(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  VALUE cScheduler = rb_const_get(mLibev, rb_intern("Scheduler"));
+
+#ifdef HAVE_SPLICE
+  rb_define_method(cScheduler, "splice", Scheduler_splice, 3);
+#endif
+#ifdef HAVE_SENDFILE
+  rb_define_method(cScheduler, "sendfile", Scheduler_sendfile, 4);
+#endif
+}
@@ -0,0 +1,263 @@
+#include "scheduler.h"
+#include "ruby/thread.h"
+#include <signal.h>
+#include <time.h>
+
+// Native watchdog for Libev::StallDetector. The scheduler's heartbeat and
+// polling flag are sampled from a pthread running without the GVL, so that
+// stalls caused by C calls holding the GVL are detected as well. The watchdog
+// records the start and end of each stall itself. Only capturing the
+// backtrace and recording the stall need the GVL, and are done by a Ruby
+// reporter thread (see Watchdog#run), once the stalled thread releases it.
+
+struct stall_watch {
+  Scheduler_t *scheduler;
+  VALUE scheduler_obj;
+  VALUE thread;
+  VALUE detector;
+  VALUE stall; // recorded stall not yet finalized, or nil
+  uint64_t threshold_ns;
+
+  pthread_t pthread;
+  int running;
+
+  // protected by lock
+  pthread_mutex_t lock;
+  pthread_cond_t cond;        // wakes the watchdog thread
+  pthread_cond_t report_cond; // wakes the reporter thread
+  int stop;
+  int interrupted;    // reporter thread interrupted by Ruby
+  int pending_start;  // stall detected, not yet recorded
+  int pending_end;    // stall ended, duration not yet finalized
+  uint64_t start_ns;  // time of last heartbeat before the stall
+  uint64_t end_ns;
+  struct timespec detected_at;
+};
+
+typedef struct stall_watch StallWatch_t;
+
+static VALUE cWatchdog;
+static ID ID_backtrace;
+static ID ID_duration_set;
+static ID ID_record;
+
+static void stall_watch_stop(StallWatch_t *watch) {
+  if (!watch->running) return;
+
+  pthread_mutex_lock(&watch->lock);
+  watch->stop = 1;
+  pthread_cond_signal(&watch->cond);
+  pthread_cond_broadcast(&watch->report_cond);
+  pthread_mutex_unlock(&watch->lock);
+  pthread_join(watch->pthread, NULL);
+  watch->running = 0;
+}
+
+static void Watchdog_mark(void *ptr) {
+  StallWatch_t *watch = ptr;
+  rb_gc_mark(watch->scheduler_obj);
+  rb_gc_mark(watch->thread);
+  rb_gc_mark(watch->detector);
+  rb_gc_mark(watch->stall);
+}
+
+static void Watchdog_free(void *ptr) {
+  StallWatch_t *watch = ptr;
+  stall_watch_stop(watch);
+  pthread_mutex_destroy(&watch->lock);
+  pthread_cond_destroy(&watch->cond);
+  pthread_cond_destroy(&watch->report_cond);
+  xfree(watch);
+}
+
+static size_t Watchdog_size(const void *ptr) {
+  return sizeof(StallWatch_t);
+}
+
+static const rb_data_type_t Watchdog_type = {
+    "LibevStallWatchdog",
+    {Watchdog_mark, Watchdog_free, Watchdog_size,},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+#define GetWatchdog(obj, watch) \
+  TypedData_Get_Struct((obj), StallWatch_t, &Watchdog_type, (watch))
+
+static VALUE Watchdog_allocate(VALUE klass) {
+  StallWatch_t *watch = ALLOC(StallWatch_t);
+  memset(watch, 0, sizeof(StallWatch_t));
+  watch->scheduler_obj = Qnil;
+  watch->thread = Qnil;
+  watch->detector = Qnil;
+  watch->stall = Qnil;
+  pthread_mutex_init(&watch->lock, NULL);
+  pthread_cond_init(&watch->report_cond, NULL);
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&watch->cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  return TypedData_Wrap_Struct(klass, &Watchdog_type, watch);
+}
+
+static void *stall_watch_thread(void *ptr) {
+  StallWatch_t *watch = ptr;
+  Scheduler_t *scheduler = watch->scheduler;
+  uint64_t interval_ns = watch->threshold_ns / 4;
+  unsigned long last_beat = __atomic_load_n(&scheduler->heartbeat, __ATOMIC_RELAXED);
+  uint64_t last_change = monotonic_ns();
+  int stalled = 0;
+
+  pthread_mutex_lock(&watch->lock);
+  while (!watch->stop) {
+    uint64_t deadline = monotonic_ns() + interval_ns;
+    struct timespec ts = { deadline / 1000000000ULL, deadline % 1000000000ULL };
+    pthread_cond_timedwait(&watch->cond, &watch->lock, &ts);
+    if (watch->stop) break;
+
+    unsigned long beat = __atomic_load_n(&scheduler->heartbeat, __ATOMIC_RELAXED);
+    unsigned int polling = __atomic_load_n(&scheduler->currently_polling, __ATOMIC_RELAXED);
+    unsigned int closed = __atomic_load_n(&scheduler->closed, __ATOMIC_RELAXED);
+    uint64_t now = monotonic_ns();
+
+    // the loop no longer runs once the scheduler is closed
+    if (beat != last_beat || polling || closed) {
+      if (stalled) {
+        stalled = 0;
+        watch->end_ns = now;
+        watch->pending_end = 1;
+        pthread_cond_signal(&watch->report_cond);
+      }
+      last_beat = beat;
+      last_change = now;
+    }
+    // a new stall is only detected once the previous one has been reported
+    else if (!stalled && !watch->pending_start && !watch->pending_end &&
+      now - last_change >= watch->threshold_ns) {
+      stalled = 1;
+      watch->start_ns = last_change;
+      clock_gettime(CLOCK_REALTIME, &watch->detected_at);
+      watch->pending_start = 1;
+      pthread_cond_signal(&watch->report_cond);
+    }
+  }
+  pthread_mutex_unlock(&watch->lock);
+  return NULL;
+}
+
+static void *stall_watch_wait(void *ptr) {
+  StallWatch_t *watch = ptr;
+
+  pthread_mutex_lock(&watch->lock);
+  while (!watch->stop && !watch->interrupted && !watch->pending_start && !watch->pending_end)
+    pthread_cond_wait(&watch->report_cond, &watch->lock);
+  watch->interrupted = 0;
+  pthread_mutex_unlock(&watch->lock);
+  return NULL;
+}
+
+static void stall_watch_interrupt(void *ptr) {
+  StallWatch_t *watch = ptr;
+
+  pthread_mutex_lock(&watch->lock);
+  watch->interrupted = 1;
+  pthread_cond_broadcast(&watch->report_cond);
+  pthread_mutex_unlock(&watch->lock);
+}
+
+static void stall_watch_report(StallWatch_t *watch) {
+  pthread_mutex_lock(&watch->lock);
+  int start = watch->pending_start;
+  int end = watch->pending_end;
+  uint64_t start_ns = watch->start_ns;
+  uint64_t end_ns = watch->end_ns;
+  struct timespec detected_at = watch->detected_at;
+  watch->pending_start = watch->pending_end = 0;
+  pthread_mutex_unlock(&watch->lock);
+
+  if (start) {
+    uint64_t duration = (end ? end_ns : monotonic_ns()) - start_ns;
+    VALUE backtrace = rb_funcall(watch->thread, ID_backtrace, 0);
+    watch->stall = rb_funcall(watch->detector, ID_record, 4,
+      watch->scheduler->current_fiber, backtrace, DBL2NUM(duration / 1e9),
+      rb_time_timespec_new(&detected_at, INT_MAX));
+  }
+  if (end && !NIL_P(watch->stall)) {
+    rb_funcall(watch->stall, ID_duration_set, 1, DBL2NUM((end_ns - start_ns) / 1e9));
+    watch->stall = Qnil;
+  }
+}
+
+// Starts watching the given scheduler, running on the given thread. Stalls are
+// recorded by calling detector#record with the blocking fiber, the thread's
+// backtrace, the stall duration and the time it was detected.
+static VALUE Watchdog_initialize(VALUE self, VALUE scheduler_obj, VALUE thread, VALUE threshold, VALUE detector) {
+  StallWatch_t *watch;
+  GetWatchdog(self, watch);
+  if (watch->running) rb_raise(rb_eRuntimeError, "watchdog already started");
+  GetScheduler(scheduler_obj, watch->scheduler);
+
+  double secs = NUM2DBL(threshold);
+  if (secs <= 0) rb_raise(rb_eArgError, "threshold must be positive");
+  watch->threshold_ns = (uint64_t)(secs * 1e9);
+  watch->scheduler_obj = scheduler_obj;
+  watch->thread = thread;
+  watch->detector = detector;
+
+  // signals are handled by Ruby's threads
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  int err = pthread_create(&watch->pthread, NULL, stall_watch_thread, watch);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (err) rb_syserr_fail(err, "pthread_create");
+  watch->running = 1;
+  return self;
+}
+
+// Reports stalls detected by the watchdog until it is stopped. Should be run
+// on a dedicated thread.
+static VALUE Watchdog_run(VALUE self) {
+  StallWatch_t *watch;
+  GetWatchdog(self, watch);
+
+  while (watch->running && !watch->stop) {
+    rb_thread_call_without_gvl(stall_watch_wait, watch, stall_watch_interrupt, watch);
+    rb_thread_check_ints();
+    stall_watch_report(watch);
+  }
+  return self;
+}
+
+static VALUE Watchdog_stop(VALUE self) {
+  StallWatch_t *watch;
+  GetWatchdog(self, watch);
+
+  stall_watch_stop(watch);
+  return self;
+}
+
+static VALUE Watchdog_running_p(VALUE self) {
+  StallWatch_t *watch;
+  GetWatchdog(self, watch);
+
+  return watch->running ? Qtrue : Qfalse;
+}
+
+void Init_StallDetector(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  VALUE cStallDetector = rb_define_class_under(mLibev, "StallDetector", rb_cObject);
+  cWatchdog = rb_define_class_under(cStallDetector, "Watchdog", rb_cObject);
+  rb_define_alloc_func(cWatchdog, Watchdog_allocate);
+
+  ID_backtrace = rb_intern("backtrace");
+  ID_duration_set = rb_intern("duration=");
+  ID_record = rb_intern("record");
+
+  rb_define_method(cWatchdog, "initialize", Watchdog_initialize, 4);
+  rb_define_method(cWatchdog, "run", Watchdog_run, 0);
+  rb_define_method(cWatchdog, "stop", Watchdog_stop, 0);
+  rb_define_method(cWatchdog, "running?", Watchdog_running_p, 0);
+}
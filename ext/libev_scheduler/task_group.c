@@ -0,0 +1,274 @@
+#include "scheduler.h"
+#include "ruby/fiber/scheduler.h"
+
+// Task groups, for running a batch of fibers and waiting for all of them to
+// finish. Spawned fibers are collected in the group, and pushed onto the
+// runqueue in a single operation at the next scheduling point (see
+// Scheduler_flush_spawn_batches). Instead of joining each fiber, the group
+// keeps a count of running fibers, and the fiber running the group waits once,
+// until the count drops to zero.
+//
+// If the joining fiber is interrupted (e.g. by Fiber#raise or a cancel scope),
+// the group is cancelled: the error is passed on to fibers still running, as
+// their resume value, fibers not yet started are skipped, and the fiber running
+// the group still waits for all of them to finish before raising the error.
+
+struct task_group {
+  Scheduler_t *scheduler;
+  VALUE fibers;  // spawned fibers, kept to prevent suspended fibers from being collected
+  VALUE results; // return values, in spawn order
+  long flushed;  // number of fibers already pushed onto the runqueue
+  long pending;  // number of fibers not yet finished
+  VALUE error;   // first exception raised in a spawned fiber
+  VALUE cancel_error; // error passed on to spawned fibers once cancelled, or nil
+  struct waiter_list joiners;
+  struct task_group *next_batch; // next group with unflushed fibers
+  int batched;
+};
+
+typedef struct task_group TaskGroup_t;
+
+static VALUE cTaskGroup;
+static VALUE cFiber;
+static VALUE eCancelled;
+static ID ID_new;
+
+static void TaskGroup_mark(void *ptr) {
+  TaskGroup_t *group = ptr;
+  rb_gc_mark(group->fibers);
+  rb_gc_mark(group->results);
+  rb_gc_mark(group->error);
+  rb_gc_mark(group->cancel_error);
+  waiter_list_mark(&group->joiners);
+}
+
+static size_t TaskGroup_size(const void *ptr) {
+  return sizeof(TaskGroup_t);
+}
+
+static const rb_data_type_t TaskGroup_type = {
+    "LibevTaskGroup",
+    {TaskGroup_mark, RUBY_TYPED_DEFAULT_FREE, TaskGroup_size,},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+#define GetTaskGroup(obj, group) \
+  TypedData_Get_Struct((obj), TaskGroup_t, &TaskGroup_type, (group))
+
+static VALUE TaskGroup_allocate(VALUE klass) {
+  TaskGroup_t *group = ALLOC(TaskGroup_t);
+  group->scheduler = NULL;
+  group->fibers = rb_ary_new();
+  group->results = rb_ary_new();
+  group->flushed = 0;
+  group->pending = 0;
+  group->error = Qnil;
+  group->cancel_error = Qnil;
+  group->joiners = (struct waiter_list){ NULL, NULL };
+  group->next_batch = NULL;
+  group->batched = 0;
+
+  return TypedData_Wrap_Struct(klass, &TaskGroup_type, group);
+}
+
+static void task_group_flush(TaskGroup_t *group) {
+  long count = RARRAY_LEN(group->fibers) - group->flushed;
+  if (count > 0) {
+    runqueue_push_batch(&group->scheduler->runqueue, RARRAY_CONST_PTR(group->fibers) + group->flushed,
+      (unsigned int)count, monotonic_ns());
+    group->flushed += count;
+  }
+}
+
+// Called at each scheduling point, pushes fibers spawned since onto the
+// runqueue
+void Scheduler_flush_spawn_batches(Scheduler_t *scheduler) {
+  while (scheduler->spawn_batches) {
+    TaskGroup_t *group = scheduler->spawn_batches;
+    scheduler->spawn_batches = group->next_batch;
+    group->batched = 0;
+    task_group_flush(group);
+  }
+}
+
+static void task_group_unbatch(TaskGroup_t *group) {
+  if (!group->batched) return;
+
+  TaskGroup_t **ptr = &group->scheduler->spawn_batches;
+  while (*ptr != group) ptr = &(*ptr)->next_batch;
+  *ptr = group->next_batch;
+  group->batched = 0;
+}
+
+static VALUE task_group_call(VALUE block) {
+  return rb_proc_call_with_block(block, 0, NULL, Qnil);
+}
+
+static VALUE task_group_fiber(RB_BLOCK_CALL_FUNC_ARGLIST(_value, arg)) {
+  VALUE group_obj = RARRAY_AREF(arg, 0);
+  TaskGroup_t *group;
+  GetTaskGroup(group_obj, group);
+
+  // fibers not yet started once an error has occurred are skipped
+  if (NIL_P(group->error) && NIL_P(group->cancel_error)) {
+    int state;
+    VALUE ret = rb_protect(task_group_call, RARRAY_AREF(arg, 1), &state);
+    if (state) {
+      VALUE error = rb_errinfo();
+      rb_set_errinfo(Qnil);
+      if (NIL_P(group->error) && rb_obj_is_kind_of(error, rb_eException)) group->error = error;
+    }
+    else
+      rb_ary_store(group->results, NUM2LONG(RARRAY_AREF(arg, 2)), ret);
+  }
+
+  // the fiber may have finished before being resumed with the cancellation
+  // error
+  if (!NIL_P(group->cancel_error))
+    runqueue_delete_value(&group->scheduler->runqueue, rb_fiber_current(), group->cancel_error);
+
+  if (--group->pending == 0) {
+    struct waiter *waiter;
+    while ((waiter = waiter_list_shift(&group->joiners))) waiter_wake(waiter, WAITER_DONE);
+  }
+  RB_GC_GUARD(group_obj);
+  return Qnil;
+}
+
+// Spawns a fiber running the given block. The fiber is started at the next
+// scheduling point, together with other fibers spawned in the meantime.
+static VALUE TaskGroup_spawn(VALUE self) {
+  TaskGroup_t *group;
+  GetTaskGroup(self, group);
+  if (!group->scheduler) rb_raise(rb_eRuntimeError, "task group is closed");
+
+  long index = RARRAY_LEN(group->fibers);
+  VALUE arg = rb_ary_new_from_args(3, self, rb_block_proc(), LONG2NUM(index));
+  // fibers created with rb_fiber_new are blocking, so go through Fiber.new
+  VALUE proc = rb_proc_new(task_group_fiber, arg);
+  VALUE fiber = rb_funcall_with_block(cFiber, ID_new, 0, NULL, proc);
+  rb_ary_push(group->fibers, fiber);
+  rb_ary_push(group->results, Qnil);
+  group->pending++;
+
+  if (!group->batched) {
+    group->batched = 1;
+    group->next_batch = group->scheduler->spawn_batches;
+    group->scheduler->spawn_batches = group;
+  }
+  return fiber;
+}
+
+static VALUE TaskGroup_size_m(VALUE self) {
+  TaskGroup_t *group;
+  GetTaskGroup(self, group);
+
+  return LONG2NUM(RARRAY_LEN(group->fibers));
+}
+
+// Passes the given error on to spawned fibers still running, and marks the
+// group as cancelled, so fibers not yet started are skipped
+static void task_group_cancel(TaskGroup_t *group, VALUE error) {
+  if (!RB_TYPE_P(error, T_OBJECT) || !rb_obj_is_kind_of(error, rb_eException))
+    error = rb_exc_new_cstr(eCancelled, "task group cancelled");
+  group->cancel_error = error;
+
+  long len = RARRAY_LEN(group->fibers);
+  for (long i = 0; i < len; i++) {
+    VALUE fiber = RARRAY_AREF(group->fibers, i);
+    if (RTEST(rb_fiber_alive_p(fiber))) SCHEDULE_VALUE(group->scheduler, fiber, error);
+  }
+}
+
+static VALUE task_group_poll(VALUE scheduler_obj) {
+  return Scheduler_poll(scheduler_obj);
+}
+
+// Waits for all fibers in the group to finish. If not called from a fiber, the
+// scheduler's loop is run until then. If interrupted, the group is cancelled,
+// and the wait goes on. The first interruption's error is returned in *error,
+// and its tag state in *state (0 if the fiber was resumed with an exception).
+static void task_group_join(VALUE self, VALUE scheduler_obj, TaskGroup_t *group, int *state, VALUE *error) {
+  task_group_unbatch(group);
+  task_group_flush(group);
+
+  int blocking = NIL_P(rb_fiber_scheduler_current());
+  while (group->pending) {
+    int wait_state;
+    VALUE ret = Qnil;
+    if (blocking)
+      rb_protect(task_group_poll, scheduler_obj, &wait_state);
+    else {
+      struct waiter waiter = { .blocker = self, .value = Qnil };
+      ret = waiter_wait(&group->joiners, &waiter, &wait_state);
+    }
+    if (!wait_state && !RESUMED_WITH_EXCEPTION(ret)) continue;
+
+    if (wait_state) {
+      ret = rb_errinfo();
+      rb_set_errinfo(Qnil);
+    }
+    if (NIL_P(group->cancel_error)) {
+      *state = wait_state;
+      *error = ret;
+      task_group_cancel(group, ret);
+    }
+  }
+}
+
+static VALUE task_group_run(VALUE self) {
+  return rb_yield(self);
+}
+
+// Runs the given block with a new task group, then waits for all fibers
+// spawned in the group to finish. Returns their return values, in spawn order.
+// If any of them raised an exception, the first one is raised.
+VALUE Scheduler_group(VALUE self) {
+  Scheduler_t *scheduler;
+  GetScheduler(self, scheduler);
+
+  VALUE group_obj = TaskGroup_allocate(cTaskGroup);
+  TaskGroup_t *group;
+  GetTaskGroup(group_obj, group);
+  group->scheduler = scheduler;
+
+  int state;
+  rb_protect(task_group_run, group_obj, &state);
+  VALUE run_error = state ? rb_errinfo() : Qnil;
+  if (state) rb_set_errinfo(Qnil);
+  // fibers already spawned are always waited for
+  int join_state = 0;
+  VALUE join_error = Qnil;
+  task_group_join(group_obj, self, group, &join_state, &join_error);
+  group->scheduler = NULL;
+
+  if (state) {
+    rb_set_errinfo(run_error);
+    rb_jump_tag(state);
+  }
+  if (join_state) {
+    rb_set_errinfo(join_error);
+    rb_jump_tag(join_state);
+  }
+  if (!NIL_P(join_error)) rb_exc_raise(join_error);
+  if (!NIL_P(group->error)) rb_exc_raise(group->error);
+  RB_GC_GUARD(group_obj);
+  return group->results;
+}
+
+void Init_TaskGroup(void) {
+  VALUE mLibev = rb_define_module("Libev");
+  VALUE cScheduler = rb_const_get(mLibev, rb_intern("Scheduler"));
+  cTaskGroup = rb_define_class_under(mLibev, "TaskGroup", rb_cObject);
+  rb_undef_alloc_func(cTaskGroup);
+
+  cFiber = rb_const_get(rb_cObject, rb_intern("Fiber"));
+  rb_gc_register_mark_object(cFiber);
+  eCancelled = rb_const_get(mLibev, rb_intern("Cancelled"));
+  ID_new = rb_intern("new");
+
+  rb_define_method(cTaskGroup, "spawn", TaskGroup_spawn, 0);
+  rb_define_method(cTaskGroup, "size", TaskGroup_size_m, 0);
+
+  rb_define_method(cScheduler, "group", Scheduler_group, 0);
+}
@@ -0,0 +1,33 @@
+#include "trace.h"
+
+trace_buffer *trace_buffer_new(unsigned int size, size_t max_output) {
+  trace_buffer *trace = ALLOC(trace_buffer);
+  trace->events = ALLOC_N(trace_event, size);
+  trace->size = size;
+  trace->count = 0;
+  trace->dropped = 0;
+  trace->max_output = max_output - max_output % sizeof(trace_event);
+  trace->output = rb_str_buf_new(0);
+  return trace;
+}
+
+void trace_buffer_free(trace_buffer *trace) {
+  xfree(trace->events);
+  xfree(trace);
+}
+
+void trace_buffer_mark(trace_buffer *trace) {
+  rb_gc_mark(trace->output);
+}
+
+void trace_buffer_flush(trace_buffer *trace) {
+  if (!trace->count) return;
+
+  size_t used = RSTRING_LEN(trace->output);
+  size_t room = (trace->max_output > used ? trace->max_output - used : 0) / sizeof(trace_event);
+  unsigned int count = trace->count < room ? trace->count : (unsigned int)room;
+  if (count)
+    rb_str_cat(trace->output, (const char *)trace->events, count * sizeof(trace_event));
+  trace->dropped += trace->count - count;
+  trace->count = 0;
+}
@@ -0,0 +1,61 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "ruby.h"
+
+enum trace_event_type {
+  TRACE_FIBER_RESUME = 1,
+  TRACE_FIBER_YIELD,
+  TRACE_IO_WAIT_START,
+  TRACE_IO_WAIT_END,
+  TRACE_TIMER_START,
+  TRACE_TIMER_FIRE,
+  TRACE_POLL_ENTER,
+  TRACE_POLL_EXIT,
+  TRACE_UNBLOCK
+};
+
+// A single trace event, 24 bytes, unpacked in Ruby using the "QQSSl" format.
+typedef struct trace_event {
+  uint64_t time;    // monotonic time (ns)
+  uint64_t fiber;   // fiber identity (0 for loop events)
+  uint16_t type;    // trace_event_type
+  uint16_t events;  // event mask (for io_wait events)
+  int32_t arg;      // fd / duration (µs) / fiber count / cross-thread flag
+} trace_event;
+
+// Trace events are recorded into a fixed-size buffer, which is flushed into a
+// binary string by the scheduler between loop iterations. Recording never
+// allocates: events recorded while the buffer is full are dropped, as are
+// events flushed once the output reaches max_output bytes. Dropped events are
+// counted.
+typedef struct trace_buffer {
+  trace_event *events;
+  unsigned int size;
+  unsigned int count;
+  unsigned long dropped;
+  size_t max_output;
+  VALUE output;
+} trace_buffer;
+
+trace_buffer *trace_buffer_new(unsigned int size, size_t max_output);
+void trace_buffer_free(trace_buffer *trace);
+void trace_buffer_mark(trace_buffer *trace);
+void trace_buffer_flush(trace_buffer *trace);
+
+static inline void trace_record(trace_buffer *trace, uint64_t time, uint16_t type, VALUE fiber, uint16_t events, int32_t arg) {
+  if (trace->count == trace->size) {
+    trace->dropped++;
+    return;
+  }
+
+  trace_event *event = &trace->events[trace->count++];
+  event->time = time;
+  event->fiber = NIL_P(fiber) ? 0 : (uint64_t)fiber;
+  event->type = type;
+  event->events = events;
+  event->arg = arg;
+}
+
+#endif /* TRACE_H */
@@ -0,0 +1,101 @@
+#include "scheduler.h"
+#include "ruby/fiber/scheduler.h"
+
+// Waiting and waking for synchronization primitives. A waiter on a Libev
+// scheduler is woken by pushing its fiber onto the scheduler's runqueue,
+// without going through the block/unblock hooks. All operations are done
+// holding the GVL, so a waiter on another thread's scheduler is woken the same
+// way Scheduler#unblock does it: by pushing it onto that scheduler's runqueue
+// and signalling its loop. Waiters running under another fiber scheduler go
+// through its block/unblock hooks, and waiters outside of a non-blocking fiber
+// put their thread to sleep.
+
+void waiter_list_mark(struct waiter_list *list) {
+  for (struct waiter *waiter = list->head; waiter; waiter = waiter->next) {
+    rb_gc_mark(waiter->fiber);
+    rb_gc_mark(waiter->value);
+  }
+}
+
+void waiter_list_push(struct waiter_list *list, struct waiter *waiter) {
+  waiter->next = NULL;
+  waiter->prev = list->tail;
+  if (list->tail) list->tail->next = waiter; else list->head = waiter;
+  list->tail = waiter;
+}
+
+void waiter_list_remove(struct waiter_list *list, struct waiter *waiter) {
+  if (waiter->prev) waiter->prev->next = waiter->next; else list->head = waiter->next;
+  if (waiter->next) waiter->next->prev = waiter->prev; else list->tail = waiter->prev;
+}
+
+struct waiter *waiter_list_shift(struct waiter_list *list) {
+  struct waiter *waiter = list->head;
+  if (waiter) waiter_list_remove(list, waiter);
+  return waiter;
+}
+
+// Returns the given fiber scheduler if it is a Libev scheduler, otherwise NULL
+Scheduler_t *waiter_current_scheduler(VALUE scheduler_obj) {
+  if (NIL_P(scheduler_obj) || !rb_typeddata_is_kind_of(scheduler_obj, &Scheduler_type)) return NULL;
+  return RTYPEDDATA_DATA(scheduler_obj);
+}
+
+void waiter_wake(struct waiter *waiter, enum waiter_state state) {
+  waiter->state = state;
+  if (waiter->scheduler) {
+    SCHEDULE(waiter->scheduler, waiter->fiber);
+    if (waiter->scheduler->currently_polling)
+      ev_async_send(waiter->scheduler->ev_loop, &waiter->scheduler->break_async);
+  }
+  else if (!NIL_P(waiter->scheduler_obj))
+    rb_fiber_scheduler_unblock(waiter->scheduler_obj, waiter->blocker, waiter->fiber);
+  else
+    rb_thread_wakeup_alive(waiter->thread);
+}
+
+static VALUE waiter_block(VALUE arg) {
+  struct waiter *waiter = (struct waiter *)arg;
+  if (NIL_P(waiter->scheduler_obj))
+    rb_thread_sleep_forever();
+  else
+    rb_fiber_scheduler_block(waiter->scheduler_obj, waiter->blocker, Qnil);
+  return Qnil;
+}
+
+// Adds the waiter to the given list and waits until it is woken, or until an
+// exception is raised in the waiting fiber. In the latter case, the tag state
+// is stored in *state, and the exception (if passed as a resume value) is
+// returned. A waiter still waiting is removed from the list. The caller should
+// check the waiter's state, then call RAISE_IF_EXCEPTION.
+VALUE waiter_wait(struct waiter_list *list, struct waiter *waiter, int *state) {
+  VALUE scheduler_obj = rb_fiber_scheduler_current();
+  waiter->scheduler = waiter_current_scheduler(scheduler_obj);
+  waiter->scheduler_obj = scheduler_obj;
+  waiter->fiber = rb_fiber_current();
+  waiter->thread = rb_thread_current();
+  waiter->state = WAITER_WAITING;
+  waiter_list_push(list, waiter);
+
+  VALUE ret = Qnil;
+  *state = 0;
+  if (waiter->scheduler) {
+    Scheduler_t *scheduler = waiter->scheduler;
+    ev_ref(scheduler->ev_loop);
+    scheduler->pending_count++;
+    while (waiter->state == WAITER_WAITING && !*state && !RESUMED_WITH_EXCEPTION(ret))
+      ret = YIELD(state);
+    scheduler->pending_count--;
+    ev_unref(scheduler->ev_loop);
+  }
+  else
+    while (waiter->state == WAITER_WAITING && !*state)
+      rb_protect(waiter_block, (VALUE)waiter, state);
+
+  if (waiter->state == WAITER_WAITING)
+    waiter_list_remove(list, waiter);
+  else if (waiter->scheduler && (*state || RESUMED_WITH_EXCEPTION(ret)))
+    runqueue_delete(&waiter->scheduler->runqueue, waiter->fiber);
+  RB_GC_GUARD(scheduler_obj);
+  return ret;
+}
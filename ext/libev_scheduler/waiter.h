@@ -0,0 +1,39 @@
+#ifndef WAITER_H
+#define WAITER_H
+
+#include "ruby.h"
+
+struct Scheduler_t;
+
+enum waiter_state { WAITER_WAITING, WAITER_DONE, WAITER_CLOSED };
+
+// A fiber (or thread) waiting on a synchronization primitive. Waiters live on
+// the waiting fiber's stack, and are linked into a FIFO list owned by the
+// primitive, so adding, removing and waking a waiter is O(1).
+struct waiter {
+  struct waiter *prev;
+  struct waiter *next;
+  struct Scheduler_t *scheduler; // NULL if not running on a Libev scheduler
+  VALUE scheduler_obj;           // fiber scheduler, or nil
+  VALUE blocker;                 // the primitive waited on
+  VALUE fiber;
+  VALUE thread;
+  VALUE value;                   // value passed to or from the waiter
+  enum waiter_state state;
+};
+
+struct waiter_list {
+  struct waiter *head;
+  struct waiter *tail;
+};
+
+void waiter_list_mark(struct waiter_list *list);
+void waiter_list_push(struct waiter_list *list, struct waiter *waiter);
+void waiter_list_remove(struct waiter_list *list, struct waiter *waiter);
+struct waiter *waiter_list_shift(struct waiter_list *list);
+
+struct Scheduler_t *waiter_current_scheduler(VALUE scheduler_obj);
+VALUE waiter_wait(struct waiter_list *list, struct waiter *waiter, int *state);
+void waiter_wake(struct waiter *waiter, enum waiter_state state);
+
+#endif /* WAITER_H */
@@ -1,23 +1,88 @@
 require_relative './libev_scheduler_ext'
+require_relative './libev_scheduler/stall_detector'
+require_relative './libev_scheduler/trace'
 
 module Libev
   class Scheduler
     def fiber(&block)
-      fiber = Fiber.new(blocking: false, &block)
+      # Suspended fibers are only referenced from watchers living on their own
+      # stacks, so they're kept here to prevent them from being collected.
+      fibers = (@fibers ||= {}.compare_by_identity)
+      fiber = Fiber.new(blocking: false) do
+        block.call
+      ensure
+        fibers.delete(Fiber.current)
+      end
+      fibers[fiber] = true
       unblock(nil, fiber)
       # fiber.resume
       return fiber
     end
 
+    # Creates a fiber running the given block only once the loop is idle (see
+    # #wait_idle).
+    def spawn_idle(&block)
+      fiber do
+        wait_idle
+        block.call
+      end
+    end
+
     def kernel_sleep(duration = nil)
       block(:sleep, duration)
     end
 
+    # Starts a watchdog thread detecting loop stalls longer than the given
+    # threshold. Should be called from the thread running the scheduler.
+    def detect_stalls(threshold: 0.1, capacity: 64, &callback)
+      @stall_detector&.stop
+      @stall_detector = StallDetector.new(
+        self, Thread.current, threshold: threshold, capacity: capacity, &callback
+      ).start
+    end
+
+    attr_reader :stall_detector
+
+    def stalls
+      @stall_detector ? @stall_detector.stalls : []
+    end
+
+    # Forwards data bidirectionally between the two given IOs until both
+    # directions reach EOF, using splice(2) so data never enters the Ruby heap.
+    # Returns the number of bytes forwarded in each direction. If either
+    # direction fails, the other one is cancelled, and the error is raised.
+    def proxy(a, b, chunk_size = 65536)
+      scope = CancelScope.new
+      group do |g|
+        g.spawn { proxy_direction(scope, a, b, chunk_size) }
+        g.spawn { proxy_direction(scope, b, a, chunk_size) }
+      end
+    end
+
     def process_wait(pid, flags)
       # This is a very simple way to implement a non-blocking wait:
       Thread.new do
         Process::Status.wait(pid, flags)
       end.value
     end  
+
+    private
+
+    def proxy_direction(scope, src, dest, chunk_size)
+      scope.run { proxy_one_way(src, dest, chunk_size) }
+    rescue Exception
+      # cancelled from outside the scope, so it is not raised here
+      scope.cancel
+      raise
+    end
+
+    def proxy_one_way(src, dest, chunk_size)
+      total = 0
+      while (len = splice(src, dest, chunk_size)) > 0
+        total += len
+      end
+      dest.close_write if dest.respond_to?(:close_write) && !dest.closed?
+      total
+    end
   end
-end
\ No newline at end of file
+end
@@ -0,0 +1,69 @@
+# frozen_string_literal: true
+
+module Libev
+  # Detects event loop stalls, i.e. fibers that block the loop by running a
+  # blocking C call or a long CPU-bound computation. The scheduler updates a
+  # heartbeat after each fiber resume and each poll. A native watchdog thread
+  # (see Watchdog) samples the heartbeat without holding the GVL. If it does not
+  # advance within the given threshold (while the loop is not polling), the
+  # backtrace of the blocking fiber is recorded by a reporter thread, once the
+  # GVL is released by the stalled thread.
+  class StallDetector
+    Stall = Struct.new(:fiber, :backtrace, :duration, :time)
+
+    attr_reader :threshold, :capacity
+
+    def initialize(scheduler, thread, threshold: 0.1, capacity: 64, &callback)
+      @scheduler = scheduler
+      @thread = thread
+      @threshold = threshold
+      @capacity = capacity
+      @callback = callback
+      @stalls = []
+      @stall_idx = 0
+    end
+
+    def start
+      unless @watchdog
+        @watchdog = Watchdog.new(@scheduler, @thread, @threshold, self)
+        Thread.new(@watchdog, &:run)
+      end
+      self
+    end
+
+    def stop
+      @watchdog&.stop
+      @watchdog = nil
+      self
+    end
+
+    def running?
+      !!@watchdog&.running?
+    end
+
+    # Returns recorded stalls, oldest first.
+    def stalls
+      @stalls.rotate(@stall_idx)
+    end
+
+    def clear
+      @stalls.clear
+      @stall_idx = 0
+    end
+
+    private
+
+    # Called by the watchdog, on the reporter thread
+    def record(fiber, backtrace, duration, time)
+      stall = Stall.new(fiber, backtrace, duration, time)
+      if @stalls.size < @capacity
+        @stalls << stall
+      else
+        @stalls[@stall_idx] = stall
+        @stall_idx = (@stall_idx + 1) % @capacity
+      end
+      @callback&.(stall)
+      stall
+    end
+  end
+end
@@ -0,0 +1,72 @@
+# frozen_string_literal: true
+
+require 'json'
+
+module Libev
+  # Converts binary trace data produced by Scheduler#stop_tracing or
+  # Scheduler#flush_trace into the Chrome trace event format, which can be
+  # loaded into chrome://tracing or https://ui.perfetto.dev.
+  module Trace
+    EVENT_FORMAT = 'QQSSl'
+    EVENT_SIZE = 24
+
+    EVENT_TYPES = %i[
+      none fiber_resume fiber_yield io_wait_start io_wait_end timer_start
+      timer_fire poll_enter poll_exit unblock
+    ].freeze
+
+    LOOP_TID = 0
+
+    class << self
+      # Returns an array of [time, fiber, type, events, arg] tuples, with time
+      # in nanoseconds and type as a symbol.
+      def events(data)
+        (data.bytesize / EVENT_SIZE).times.map do |i|
+          time, fiber, type, events, arg = data.unpack(EVENT_FORMAT, offset: i * EVENT_SIZE)
+          [time, fiber, EVENT_TYPES[type], events, arg]
+        end
+      end
+
+      def to_chrome(data, pid: Process.pid)
+        fiber_ids = {}
+        t0 = nil
+
+        trace_events = events(data).map do |(time, fiber, type, events, arg)|
+          t0 ||= time
+          ts = (time - t0) / 1000.0
+          tid = fiber.zero? ? LOOP_TID : (fiber_ids[fiber] ||= fiber_ids.size + 1)
+          chrome_event(type, ts, pid, tid, events, arg)
+        end
+
+        thread_names = fiber_ids.map do |_, tid|
+          { name: 'thread_name', ph: 'M', pid: pid, tid: tid, args: { name: "fiber #{tid}" } }
+        end
+        thread_names << { name: 'thread_name', ph: 'M', pid: pid, tid: LOOP_TID, args: { name: 'event loop' } }
+
+        { traceEvents: thread_names + trace_events }
+      end
+
+      def to_chrome_json(data, pid: Process.pid)
+        JSON.generate(to_chrome(data, pid: pid))
+      end
+
+      private
+
+      def chrome_event(type, ts, pid, tid, events, arg)
+        event = { ts: ts, pid: pid, tid: tid }
+        case type
+        when :fiber_resume  then event.merge(name: 'run', ph: 'B')
+        when :fiber_yield   then event.merge(name: 'run', ph: 'E')
+        when :poll_enter    then event.merge(name: 'poll', ph: 'B')
+        when :poll_exit     then event.merge(name: 'poll', ph: 'E', args: { ready: arg })
+        when :io_wait_start then event.merge(name: 'io_wait', ph: 'b', cat: 'io', id: tid, args: { fd: arg, events: events })
+        when :io_wait_end   then event.merge(name: 'io_wait', ph: 'e', cat: 'io', id: tid, args: { fd: arg, events: events })
+        when :timer_start   then event.merge(name: 'timer_start', ph: 'i', s: 't', args: { duration_us: arg })
+        when :timer_fire    then event.merge(name: 'timer_fire', ph: 'i', s: 't')
+        when :unblock       then event.merge(name: 'unblock', ph: 'i', s: 't', args: { cross_thread: arg != 0 })
+        else event.merge(name: type.to_s, ph: 'i', s: 't')
+        end
+      end
+    end
+  end
+end
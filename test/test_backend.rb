@@ -0,0 +1,84 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestBackend < MiniTest::Test
+  def with_backend(backend)
+    Thread.new do
+      scheduler = Libev::Scheduler.new(backend: backend)
+      Fiber.set_scheduler scheduler
+      yield scheduler
+    end.join
+  rescue RuntimeError => e
+    raise unless e.message == 'backend not available'
+    skip "#{backend} backend not available"
+  end
+
+  def test_default_backend
+    backend = nil
+    Thread.new { backend = Libev::Scheduler.new.backend }.join
+
+    assert_kind_of Symbol, backend
+  end
+
+  def test_unknown_backend
+    assert_raises(ArgumentError) do
+      Thread.new do
+        Thread.current.report_on_exception = false
+        Libev::Scheduler.new(backend: :foo)
+      end.join
+    end
+  end
+
+  def test_poll_backend
+    backend = nil
+    sleep_duration = nil
+
+    with_backend(:poll) do |scheduler|
+      backend = scheduler.backend
+      Fiber.schedule do
+        t0 = Time.now
+        sleep 0.02
+        sleep_duration = Time.now - t0
+      end
+    end
+
+    assert_equal :poll, backend
+    assert_in_range 0.015..0.1, sleep_duration
+  end
+
+  def test_io_uring_timeouts
+    backend = nil
+    timed_out = nil
+    sleep_duration = nil
+    buf = +''
+
+    with_backend(:io_uring) do |scheduler|
+      backend = scheduler.backend
+      r, w = IO.pipe
+
+      Fiber.schedule do
+        timed_out = r.wait_readable(0.01)
+        r.wait_readable(1)
+        buf << r.read_nonblock(16)
+      end
+      Fiber.schedule do
+        t0 = Time.now
+        sleep 0.03
+        sleep_duration = Time.now - t0
+        w << 'foo'
+      end
+    end
+
+    assert_equal :io_uring, backend
+    assert_nil timed_out
+    assert_in_range 0.025..0.2, sleep_duration
+    assert_equal 'foo', buf
+  end
+
+  def assert_in_range exp_range, act
+    msg = message(msg) { "Expected #{mu_pp(act)} to be in range #{mu_pp(exp_range)}" }
+    assert exp_range.include?(act), msg
+  end
+end
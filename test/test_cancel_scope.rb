@@ -0,0 +1,144 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestCancelScope < MiniTest::Test
+  def test_cancel_waiting_fibers
+    scope = Libev::CancelScope.new
+    i, _o = IO.pipe
+    results = []
+    ensured = 0
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule { results << scope.run { sleep 10 } }
+      Fiber.schedule { results << scope.run { i.read } }
+      Fiber.schedule { results << scope.run { Libev::Channel.new.pop } }
+      Fiber.schedule do
+        results << scope.run do
+          sleep
+        ensure
+          ensured += 1
+        end
+      end
+      Fiber.schedule do
+        sleep 0.01
+        scope.cancel
+      end
+    end.join
+
+    assert_equal [nil] * 4, results
+    assert_equal 1, ensured
+    assert_predicate scope, :cancelled?
+    refute_predicate scope, :timed_out?
+  end
+
+  def test_cancel_from_within_scope
+    scope = Libev::CancelScope.new
+    events = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        scope.run do
+          events << :started
+          scope.cancel
+          events << :not_reached
+        end
+        events << :done
+      end
+    end.join
+
+    assert_equal [:started, :done], events
+  end
+
+  def test_timeout
+    scope = Libev::CancelScope.new(0.02)
+    result = :none
+    elapsed = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        result = scope.run { sleep 1; :finished }
+        elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+      end
+    end.join
+
+    assert_nil result
+    assert_predicate scope, :timed_out?
+    assert_operator elapsed, :<, 0.5
+  end
+
+  def test_timeout_not_reached
+    scope = Libev::CancelScope.new(1)
+    result = nil
+    elapsed = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      Fiber.schedule { result = scope.run { sleep 0.01; :finished } }
+      scheduler.run
+      elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+    end.join
+
+    assert_equal :finished, result
+    refute_predicate scope, :cancelled?
+    # the timer is stopped once the scope is left
+    assert_operator elapsed, :<, 0.5
+  end
+
+  def test_nested_scopes
+    outer = Libev::CancelScope.new
+    inner = Libev::CancelScope.new(0.01)
+    events = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        events << outer.run do
+          events << inner.run { sleep 1 }
+          events << :inner_done
+          sleep 1
+          :not_reached
+        end
+      end
+      Fiber.schedule do
+        sleep 0.05
+        outer.cancel
+      end
+    end.join
+
+    assert_equal [nil, :inner_done, nil], events
+    assert_predicate inner, :timed_out?
+    assert_predicate outer, :cancelled?
+  end
+
+  def test_run_cancelled_scope
+    scope = Libev::CancelScope.new
+    scope.cancel
+    result = :none
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule { result = scope.run { :ran } }
+    end.join
+
+    assert_nil result
+  end
+end
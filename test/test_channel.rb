@@ -0,0 +1,149 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestChannel < MiniTest::Test
+  def test_push_pop
+    channel = Libev::Channel.new
+    received = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        3.times { received << channel.pop }
+      end
+
+      Fiber.schedule do
+        channel << 1
+        channel << 2
+        sleep 0.01
+        channel << 3
+      end
+    end.join
+
+    assert_equal [1, 2, 3], received
+    assert_predicate channel, :empty?
+  end
+
+  def test_bounded_push_waits
+    channel = Libev::Channel.new(2)
+    events = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        4.times do |i|
+          channel << i
+          events << [:pushed, i]
+        end
+      end
+
+      Fiber.schedule do
+        4.times { events << [:popped, channel.pop] }
+      end
+    end.join
+
+    assert_equal 2, channel.capacity
+    assert_equal [[:pushed, 0], [:pushed, 1], [:popped, 0], [:popped, 1],
+      [:popped, 2], [:pushed, 2], [:pushed, 3], [:popped, 3]], events
+  end
+
+  def test_close
+    channel = Libev::Channel.new(1)
+    popped = :none
+    error = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule { popped = channel.pop }
+      Fiber.schedule do
+        channel << 1 # handed to the waiting popper
+        channel << 2
+        channel << 3 # waits, the channel is full
+      rescue ClosedQueueError => e
+        error = e
+      end
+      Fiber.schedule { channel.close }
+    end.join
+
+    assert_equal 1, popped
+    assert_kind_of ClosedQueueError, error
+    assert_predicate channel, :closed?
+    assert_equal 2, channel.pop
+    assert_nil channel.pop
+    assert_raises(ClosedQueueError) { channel << 3 }
+  end
+
+  def test_raise_while_waiting
+    channel = Libev::Channel.new
+    error = nil
+    received = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      f = Fiber.schedule do
+        channel.pop
+      rescue => e
+        error = e
+      end
+      Fiber.schedule { f.raise 'foo' }
+      Fiber.schedule do
+        sleep 0.01
+        channel << 1
+        received = channel.pop
+      end
+    end.join
+
+    assert_equal 'foo', error&.message
+    assert_equal 1, received
+  end
+
+  def test_cross_thread
+    channel = Libev::Channel.new(8)
+    received = []
+
+    consumer = Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        while (value = channel.pop)
+          received << value
+        end
+      end
+    end
+
+    producer = Thread.new do
+      100.times { |i| channel << i }
+      channel.close
+    end
+
+    [producer, consumer].each(&:join)
+    assert_equal (0...100).to_a, received
+  end
+
+  def test_blocking_pop
+    channel = Libev::Channel.new
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        sleep 0.01
+        channel << :foo
+      end
+    end
+
+    assert_equal :foo, channel.pop
+  end
+end
@@ -0,0 +1,137 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+require 'socket'
+
+class TestCork < MiniTest::Test
+  def test_cork_coalesces_writes
+    i, o = UNIXSocket.pair
+    before = nil
+    after = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        scheduler.cork(o)
+        o << 'foo'
+        o << 'bar'
+        before = i.read_nonblock(100, exception: false)
+        sleep 0.01
+        after = i.read_nonblock(100, exception: false)
+        scheduler.uncork(o)
+      end
+    end.join
+
+    assert_equal :wait_readable, before
+    assert_equal 'foobar', after
+  end
+
+  def test_cork_threshold
+    i, o = UNIXSocket.pair
+    received = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        scheduler.cork(o, 4)
+        o << 'foo'
+        o << 'bar'
+        received = i.read_nonblock(100, exception: false)
+        scheduler.uncork(o)
+      end
+    end.join
+
+    assert_equal 'foobar', received
+  end
+
+  def test_cork_ordering
+    i, o = UNIXSocket.pair
+    data = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      scheduler.cork(o, 1024)
+      done = 0
+
+      10.times do |n|
+        Fiber.schedule do
+          1000.times { o << "#{n}:#{'x' * 50}\n" }
+          done += 1
+          if done == 10
+            scheduler.uncork(o)
+            o.close
+          end
+        end
+      end
+
+      Fiber.schedule { data = i.read }
+    end.join
+
+    lines = data.lines
+    assert_equal 10000, lines.size
+    10.times do |n|
+      assert_equal 1000, lines.count { |l| l == "#{n}:#{'x' * 50}\n" }
+    end
+  end
+
+  def test_uncork_flushes
+    i, o = UNIXSocket.pair
+    received = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        scheduler.cork(o)
+        o << 'foo'
+        assert scheduler.corked?(o)
+        scheduler.uncork(o)
+        refute scheduler.corked?(o)
+        received = i.read_nonblock(100, exception: false)
+      end
+    end.join
+
+    assert_equal 'foo', received
+  end
+
+  def test_uncork_while_writing
+    i, o = UNIXSocket.pair
+    filled = +''
+    loop do
+      ret = o.write_nonblock('f' * 65536, exception: false)
+      break if ret == :wait_writable
+      filled << 'f' * ret
+    end
+    data = 'x' * 100_000
+    written = nil
+    received = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      scheduler.cork(o, 1024)
+
+      # the socket is full, so both fibers wait for the buffer to be written
+      # out, the first one uncorking (and closing) it before the second one is
+      # resumed
+      Fiber.schedule do
+        o << 'a' * 100
+        scheduler.uncork(o)
+        sleep 0.001 until written
+        o.close
+      end
+      Fiber.schedule { written = o.write(data) }
+      Fiber.schedule { received = i.read }
+    end.join
+
+    assert_equal data.bytesize, written
+    assert_equal filled + 'a' * 100 + data, received
+  end
+end
@@ -0,0 +1,113 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestEmbed < MiniTest::Test
+  def test_backend_fd
+    fd = nil
+    Thread.new do
+      fd = Libev::Scheduler.new.backend_fd
+    end.join
+
+    assert_kind_of Integer, fd
+  end
+
+  def test_run_nowait_from_host_loop
+    done = false
+    timeouts = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      backend = IO.for_fd(scheduler.backend_fd, autoclose: false)
+
+      timeouts << scheduler.next_timeout
+      Fiber.schedule do
+        sleep 0.05
+        done = true
+      end
+      timeouts << scheduler.next_timeout
+      scheduler.run_nowait
+      timeouts << scheduler.next_timeout
+
+      # a host loop waiting on the backend fd, instead of the scheduler's own
+      until done
+        IO.select([backend], nil, nil, scheduler.next_timeout)
+        scheduler.run_nowait
+      end
+    end.join
+
+    assert done
+    assert_nil timeouts[0]
+    assert_equal 0, timeouts[1] # fiber ready to run
+    assert_in_range 0.01..0.05, timeouts[2]
+  end
+
+  def test_embed
+    events = []
+    t0 = Time.now
+
+    Thread.new do
+      parent = Libev::Scheduler.new
+      Fiber.set_scheduler parent
+      child = Libev::Scheduler.new
+      parent.embed(child)
+      r, w = IO.pipe
+
+      Fiber.schedule do
+        child.io_wait(r, IO::READABLE, nil)
+        events << :readable
+      end
+      Fiber.schedule do
+        child.block(nil, 0.05)
+        events << :timer
+      end
+      Fiber.schedule do
+        sleep 0.02
+        w << 'foo'
+      end
+    end.join
+
+    assert_equal [:readable, :timer], events
+    assert_in_range 0.04..0.2, Time.now - t0
+  end
+
+  def test_unembed
+    embedded = []
+
+    Thread.new do
+      parent = Libev::Scheduler.new
+      child = Libev::Scheduler.new
+      parent.embed(child)
+      embedded << child.embedded?
+      assert_raises(RuntimeError) { parent.embed(child) }
+      assert_raises(ArgumentError) { child.embed(parent) }
+      assert_raises(ArgumentError) { parent.embed(parent) }
+      parent.unembed(child)
+      embedded << child.embedded?
+      assert_raises(ArgumentError) { parent.unembed(child) }
+    end.join
+
+    assert_equal [true, false], embedded
+  end
+
+  def test_embed_cycle
+    Thread.new do
+      a = Libev::Scheduler.new
+      b = Libev::Scheduler.new
+      c = Libev::Scheduler.new
+      a.embed(b)
+      b.embed(c)
+      assert_raises(ArgumentError) { c.embed(a) }
+      a.run_nowait
+      b.unembed(c)
+      a.unembed(b)
+    end.join
+  end
+
+  def assert_in_range exp_range, act
+    msg = message(msg) { "Expected #{mu_pp(act)} to be in range #{mu_pp(exp_range)}" }
+    assert exp_range.include?(act), msg
+  end
+end
@@ -0,0 +1,172 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+require 'tempfile'
+require 'io/nonblock'
+
+class TestFileIO < MiniTest::Test
+  def setup
+    skip 'io_read hook not supported' unless Libev::Scheduler.method_defined?(:io_read)
+  end
+
+  def test_file_read_write
+    files = 4.times.map { Tempfile.new('libev') }
+    contents = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      files.each_with_index do |f, i|
+        Fiber.schedule do
+          f.sync = true
+          f.write("#{i}" * 100_000)
+          scheduler.fsync(f)
+          f.rewind
+          contents[i] = f.read
+        end
+      end
+    end.join
+
+    4.times do |i|
+      assert_equal "#{i}" * 100_000, contents[i]
+    end
+  ensure
+    files&.each(&:close!)
+  end
+
+  def test_pread_pwrite
+    f = Tempfile.new('libev')
+    result = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        scheduler.pwrite(f, 'foobar', 0)
+        scheduler.pwrite(f, 'baz', 3)
+        result = scheduler.pread(f, 6, 0)
+      end
+    end.join
+
+    assert_equal 'foobaz', result
+  ensure
+    f&.close!
+  end
+
+  def test_file_io_does_not_block_other_fibers
+    f = Tempfile.new('libev')
+    f.sync = true
+    ticks = 0
+    done = false
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        20.times { f.write('x' * 65536) }
+        done = true
+      end
+
+      Fiber.schedule do
+        until done
+          ticks += 1
+          sleep 0
+        end
+      end
+    end.join
+
+    assert_equal 20 * 65536, File.size(f.path)
+    assert ticks > 1
+  ensure
+    f&.close!
+  end
+
+  def test_pipe_read_write
+    i, o = IO.pipe
+    received = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule { received = i.read }
+      Fiber.schedule do
+        o << 'foo'
+        sleep 0.01
+        o << 'bar'
+        o.close
+      end
+    end.join
+
+    assert_equal 'foobar', received
+  end
+
+  def test_fd_reused_by_pipe
+    received = nil
+
+    thread = Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        f = File.open(__FILE__)
+        fd = f.fileno
+        f.readpartial(16)
+        f.close
+        f = nil
+        GC.start
+
+        # the pipe must not be read as a regular file
+        extra = []
+        i = o = nil
+        loop do
+          i, o = IO.pipe
+          break if i.fileno == fd
+          extra << i
+          if o.fileno == fd
+            o.close # the lowest free fd again
+          else
+            extra << o
+          end
+        end
+        extra.each(&:close)
+        Fiber.schedule do
+          sleep 0.02
+          o << 'foo'
+        end
+        received = i.readpartial(16)
+      end
+    end
+    assert thread.join(5), 'thread blocked'
+
+    assert_equal 'foo', received
+  end
+
+  def test_pipe_made_blocking
+    received = []
+
+    thread = Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      i, o = IO.pipe
+
+      Fiber.schedule do
+        received << i.readpartial(16)
+        i.nonblock = false
+        received << i.readpartial(16) # must not block the loop
+      end
+      Fiber.schedule do
+        o << 'foo'
+        sleep 0.02
+        o << 'bar'
+      end
+    end
+    assert thread.join(5), 'thread blocked'
+
+    assert_equal ['foo', 'bar'], received
+  end
+end
@@ -0,0 +1,122 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+require 'fileutils'
+require 'tmpdir'
+
+class TestFileWatch < MiniTest::Test
+  def setup
+    @dir = Dir.mktmpdir
+    @path = File.join(@dir, 'config')
+  end
+
+  def teardown
+    FileUtils.rm_rf(@dir)
+  end
+
+  def test_wait_file_change
+    result = nil
+    t0 = Time.now
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        result = scheduler.wait_file_change(@path)
+      end
+      Fiber.schedule do
+        sleep 0.02
+        File.write(@path, 'foo')
+      end
+    end.join
+
+    prev, cur = result
+    assert_nil prev
+    assert_kind_of File::Stat, cur
+    assert_in_range 0.01..1, Time.now - t0
+  end
+
+  def test_wait_file_change_timeout
+    result = :none
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        result = scheduler.wait_file_change(@path, timeout: 0.02)
+      end
+    end.join
+
+    assert_nil result
+  end
+
+  def test_watch_file
+    File.write(@path, 'a')
+    sizes = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        scheduler.watch_file(@path) do |prev, cur|
+          sizes << [prev&.size, cur&.size]
+          break unless cur
+        end
+      end
+      Fiber.schedule do
+        sleep 0.02
+        File.write(@path, 'abc')
+        sleep 0.02
+        FileUtils.rm(@path)
+      end
+    end.join
+
+    assert_equal [[1, 3], [3, nil]], sizes
+  end
+
+  def test_spurious_resume
+    result = nil
+    sizes = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      waiter = Fiber.schedule do
+        result = scheduler.wait_file_change(@path, timeout: 1)
+      end
+      watcher = Fiber.schedule do
+        scheduler.watch_file(@path) do |prev, cur|
+          sizes << cur&.size
+          break
+        end
+      end
+      Fiber.schedule do
+        # resumed without any change to the file
+        scheduler.unblock(nil, waiter)
+        scheduler.unblock(nil, watcher)
+        sleep 0.02
+        File.write(@path, 'foo')
+      end
+    end.join
+
+    assert_kind_of File::Stat, result&.last
+    assert_equal [3], sizes
+  end
+
+  def test_wrong_scheduler
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      assert_raises(RuntimeError) { scheduler.wait_file_change(@path) }
+    end.join
+  end
+
+  def assert_in_range exp_range, act
+    msg = message(msg) { "Expected #{mu_pp(act)} to be in range #{mu_pp(exp_range)}" }
+    assert exp_range.include?(act), msg
+  end
+end
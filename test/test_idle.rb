@@ -0,0 +1,87 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestIdle < MiniTest::Test
+  def test_spawn_idle
+    events = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      scheduler.spawn_idle { events << :idle }
+      Fiber.schedule do
+        events << :a
+        scheduler.yield
+        events << :b
+      end
+      Fiber.schedule { events << :c }
+    end.join
+
+    assert_equal [:a, :c, :b, :idle], events
+  end
+
+  def test_idle_waits_for_io
+    events = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      r, w = IO.pipe
+
+      Fiber.schedule do
+        5.times do |i|
+          w << 'x'
+          scheduler.yield
+        end
+        w.close
+      end
+      Fiber.schedule do
+        while r.read(1)
+          events << :read
+        end
+      end
+      scheduler.spawn_idle do
+        3.times do
+          events << :idle
+          scheduler.wait_idle
+        end
+      end
+    end.join
+
+    assert_equal 3, events.count(:idle)
+    assert_equal 5, events.count(:read)
+    # background work interleaved with, but never ahead of, the readers
+    assert_equal :read, events.first
+  end
+
+  def test_idle_while_sleeping
+    count = 0
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule { sleep 0.05 }
+      scheduler.spawn_idle do
+        while count < 5
+          count += 1
+          scheduler.wait_idle
+        end
+      end
+    end.join
+
+    assert_equal 5, count
+  end
+
+  def test_wait_idle_outside_fiber
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      assert_raises(RuntimeError) { scheduler.wait_idle }
+    end.join
+  end
+end
@@ -76,4 +76,53 @@ class TestFiberIO < MiniTest::Test
     thread.join
     assert finished
   end
+
+  def test_waiting_fibers_survive_gc
+    pipes = 100.times.map { IO.pipe }
+    received = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      pipes.each do |i, _o|
+        Fiber.schedule { received << i.read }
+      end
+
+      Fiber.schedule do
+        GC.start
+        GC.compact if GC.respond_to?(:compact)
+        pipes.each { |_i, o| o << 'foo'; o.close }
+      end
+    end.join
+
+    assert_equal ['foo'] * 100, received
+  end
+
+  def test_wait_after_reopen_and_close
+    _i, o = IO.pipe
+    other_i, other_o = IO.pipe
+    message = nil
+    error = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        o.wait_writable
+        # the same IO object now refers to a different fd
+        o.reopen(other_o)
+        o.write('foo')
+        message = other_i.read(3)
+        o.close
+        o.wait_writable
+      rescue IOError => e
+        error = e
+      end
+    end.join
+
+    assert_equal 'foo', message
+    assert_kind_of IOError, error
+  end
 end
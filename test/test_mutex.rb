@@ -138,6 +138,31 @@ class TestFiberMutex < MiniTest::Test
     assert_equal 3, signalled
   end
 
+  def test_condition_variable_zero_timeout
+    mutex = Mutex.new
+    condition = ConditionVariable.new
+    slept = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        mutex.synchronize { condition.wait(mutex, 0) }
+        t0 = Time.now
+        sleep 0.05
+        slept = Time.now - t0
+      end
+
+      # signals while the waiting fiber is already queued by its zero timeout
+      Fiber.schedule do
+        mutex.synchronize { condition.signal }
+      end
+    end.join
+
+    assert_operator slept, :>=, 0.04
+  end
+
   def test_queue
     queue = Queue.new
     processed = 0
@@ -0,0 +1,89 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestPeriodic < MiniTest::Test
+  def test_sleep_until
+    times = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        target = Time.now + 0.05
+        scheduler.sleep_until(target)
+        times << Time.now - target
+        scheduler.sleep_until(Time.now.to_f - 1) # in the past
+        times << :past
+      end
+    end.join
+
+    assert_in_range 0..0.05, times[0]
+    assert_equal :past, times[1]
+  end
+
+  def test_every_aligned
+    ticks = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        scheduler.every(0.02, offset: 0.005) do
+          ticks << Time.now.to_f
+          break if ticks.size == 5
+        end
+      end
+    end.join
+
+    assert_equal 5, ticks.size
+    ticks.each do |t|
+      phase = (t - 0.005) % 0.02
+      assert_in_range 0..0.01, phase
+    end
+  end
+
+  def test_every_coalesces_missed_ticks
+    count = 0
+    t0 = Time.now
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        scheduler.every(0.01) do
+          count += 1
+          sleep 0.035 # spans several ticks
+          break if count == 3
+        end
+      end
+    end.join
+
+    assert_equal 3, count
+    assert_in_range 0.1..0.2, Time.now - t0
+  end
+
+  def test_every_errors
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      assert_raises(RuntimeError) { scheduler.every(1) { } }
+      Fiber.schedule do
+        assert_raises(ArgumentError) { scheduler.every(0) { } }
+        assert_raises(ZeroDivisionError) do
+          scheduler.every(0.01) { raise ZeroDivisionError }
+        end
+      end
+    end.join
+  end
+
+  def assert_in_range exp_range, act
+    msg = message(msg) { "Expected #{mu_pp(act)} to be in range #{mu_pp(exp_range)}" }
+    assert exp_range.include?(act), msg
+  end
+end
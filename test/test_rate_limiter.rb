@@ -0,0 +1,46 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestRateLimiter < MiniTest::Test
+  def test_rate
+    limiter = Libev::RateLimiter.new(100, 2)
+    times = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      6.times do
+        Fiber.schedule do
+          limiter.acquire
+          times << Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+        end
+      end
+    end.join
+
+    assert_equal 6, times.size
+    # the first two tokens are available immediately, the rest at 100/s
+    assert_operator times[1], :<, 0.005
+    assert_operator times[5], :>=, 0.035
+    assert_operator times[5], :<, 0.2
+    assert_equal times.sort, times
+  end
+
+  def test_try_acquire
+    limiter = Libev::RateLimiter.new(1)
+
+    assert_equal true, limiter.try_acquire
+    assert_equal false, limiter.try_acquire
+    assert_operator limiter.available, :<, 1
+  end
+
+  def test_acquire_outside_of_scheduler
+    limiter = Libev::RateLimiter.new(1)
+    limiter.acquire
+
+    assert_raises(RuntimeError) { limiter.acquire }
+  end
+end
@@ -0,0 +1,85 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestRegisterIO < MiniTest::Test
+  def test_registered_read_write
+    i, o = IO.pipe
+    received = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      assert scheduler.register_io(i)
+      assert scheduler.register_io(o)
+
+      Fiber.schedule do
+        while (data = i.read(5))
+          received << data
+        end
+      end
+
+      Fiber.schedule do
+        3.times do |n|
+          o.write("msg-#{n}")
+          sleep 0.01
+        end
+        scheduler.deregister_io(o)
+        o.close
+      end
+    end.join
+
+    assert_equal 'msg-0msg-1msg-2', received.join
+  end
+
+  def test_cached_readiness
+    i, o = IO.pipe
+    scheduler = nil
+    data = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      scheduler.register_io(i)
+
+      Fiber.schedule do
+        o << 'hello'
+        sleep 0.01 # the edge is reported during this poll and cached
+        scheduler.start_tracing
+        i.wait_readable
+        data = i.read_nonblock(5)
+      end
+    end.join
+
+    assert_equal 'hello', data
+    events = Libev::Trace.events(scheduler.stop_tracing)
+    refute events.any? { |e| e[2] == :io_wait_start }
+  end
+
+  def test_registered_timeout
+    i, _o = IO.pipe
+    result = :none
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      scheduler.register_io(i)
+
+      Fiber.schedule do
+        result = i.wait_readable(0.01)
+      end
+    end.join
+
+    assert_nil result
+  end
+
+  def test_register_regular_file
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      File.open(__FILE__) do |f|
+        refute scheduler.register_io(f)
+      end
+    end.join
+  end
+end
@@ -0,0 +1,91 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestSelect < MiniTest::Test
+  def test_select_waits_for_readable
+    i, o = IO.pipe
+    result = nil
+    order = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        result = IO.select([i])
+        order << :selected
+      end
+
+      Fiber.schedule do
+        order << :writing
+        o << 'foo'
+      end
+    end.join
+
+    assert_equal [[i], [], []], result
+    assert_equal [:writing, :selected], order
+  end
+
+  def test_select_timeout
+    i, _o = IO.pipe
+    result = :none
+    elapsed = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        result = IO.select([i], nil, nil, 0.05)
+        elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+      end
+    end.join
+
+    assert_nil result
+    assert_operator elapsed, :>=, 0.04
+  end
+
+  def test_select_ready_without_waiting
+    i, o = IO.pipe
+    results = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        results << IO.select([i], [o], nil, 0)
+        o << 'foobar'
+        # data already read into the IO's buffer counts as readable
+        i.getc
+        results << IO.select([i], nil, nil, 0)
+        i.read_nonblock(5)
+        results << IO.select([i], nil, nil, 0)
+      end
+    end.join
+
+    assert_equal [[[], [o], []], [[i], [], []], nil], results
+  end
+
+  def test_select_raise
+    i, _o = IO.pipe
+    error = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      f = Fiber.schedule do
+        IO.select([i])
+      rescue => e
+        error = e
+      end
+      Fiber.schedule { f.raise 'foo' }
+    end.join
+
+    assert_equal 'foo', error&.message
+  end
+end
@@ -0,0 +1,81 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestSemaphore < MiniTest::Test
+  def test_limits_concurrency
+    semaphore = Libev::Semaphore.new(2)
+    running = 0
+    max_running = 0
+    order = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      5.times do |i|
+        Fiber.schedule do
+          semaphore.synchronize do
+            order << i
+            running += 1
+            max_running = running if running > max_running
+            sleep 0.01
+            running -= 1
+          end
+        end
+      end
+    end.join
+
+    assert_equal 2, max_running
+    assert_equal [0, 1, 2, 3, 4], order
+    assert_equal 2, semaphore.available
+  end
+
+  def test_fifo_without_barging
+    semaphore = Libev::Semaphore.new(0)
+    order = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule { semaphore.acquire; order << :first }
+      Fiber.schedule { semaphore.acquire; order << :second }
+      Fiber.schedule do
+        semaphore.release
+        # the released permit belongs to the first waiter
+        order << semaphore.try_acquire
+        semaphore.release
+      end
+    end.join
+
+    assert_equal [false, :first, :second], order
+    assert_equal 0, semaphore.available
+  end
+
+  def test_raise_while_waiting
+    semaphore = Libev::Semaphore.new(0)
+    error = nil
+    acquired = false
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      f = Fiber.schedule do
+        semaphore.acquire
+      rescue => e
+        error = e
+      end
+      Fiber.schedule { semaphore.acquire; acquired = true }
+      Fiber.schedule do
+        f.raise 'foo'
+        semaphore.release
+      end
+    end.join
+
+    assert_equal 'foo', error&.message
+    assert acquired
+  end
+end
@@ -0,0 +1,136 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestSignals < MiniTest::Test
+  def test_wait_signal
+    received = nil
+    ruby_trapped = false
+    old_handler = Signal.trap('USR1') { ruby_trapped = true }
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        received = scheduler.wait_signal(:USR1)
+      end
+      Fiber.schedule do
+        sleep 0.01
+        Process.kill('USR1', Process.pid)
+      end
+    end.join
+
+    assert_equal Signal.list['USR1'], received
+    refute ruby_trapped
+
+    # the previous handler is restored when the scheduler is closed
+    Process.kill('USR1', Process.pid)
+    sleep 0.05
+    assert ruby_trapped
+  ensure
+    Signal.trap('USR1', old_handler)
+  end
+
+  def test_signal_kept_between_waits
+    received = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        received << scheduler.wait_signal(:USR1)
+        Process.kill('USR1', Process.pid)
+        sleep 0.02 # delivered while not waiting
+        received << scheduler.wait_signal(:USR1)
+        scheduler.untrap(:USR1)
+      end
+      Fiber.schedule do
+        Process.kill('USR1', Process.pid)
+      end
+    end.join
+
+    assert_equal [Signal.list['USR1']] * 2, received
+  end
+
+  def test_trap
+    received = []
+    fibers = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      scheduler.trap('SIGUSR2') do |sig|
+        received << sig
+        fibers << Fiber.current
+        sleep 0.001 # handlers run in non-blocking fibers
+      end
+      Fiber.schedule do
+        3.times do
+          Process.kill('USR2', Process.pid)
+          sleep 0.02
+        end
+        scheduler.untrap(:USR2)
+      end
+    end.join
+
+    assert_equal [Signal.list['USR2']] * 3, received
+    assert_equal 3, fibers.uniq.size
+  end
+
+  def test_signal_watched_by_another_scheduler
+    error = nil
+
+    Thread.new do
+      scheduler1 = Libev::Scheduler.new
+      scheduler2 = Libev::Scheduler.new
+      scheduler1.trap(:USR1) { }
+      begin
+        scheduler2.trap(:USR1) { }
+      rescue => e
+        error = e
+      end
+      scheduler1.untrap(:USR1)
+    end.join
+
+    assert_kind_of ArgumentError, error
+  end
+
+  def test_signal_watched_from_several_threads
+    ruby_trapped = false
+    old_handler = Signal.trap('USR2') { ruby_trapped = true }
+    owned = [0, 0]
+
+    threads = 2.times.map do |i|
+      Thread.new do
+        scheduler = Libev::Scheduler.new
+        500.times do
+          scheduler.trap(:USR2) { }
+          owned[i] += 1
+          Thread.pass
+          scheduler.untrap(:USR2)
+        rescue ArgumentError
+          Thread.pass
+        end
+        scheduler.close
+      end
+    end
+    threads.each(&:join)
+
+    assert_operator owned.sum, :>, 0
+    # the Ruby handler is restored once no scheduler watches the signal
+    Process.kill('USR2', Process.pid)
+    sleep 0.05
+    assert ruby_trapped
+  ensure
+    Signal.trap('USR2', old_handler)
+  end
+
+  def test_invalid_signal
+    scheduler = Libev::Scheduler.new
+    assert_raises(ArgumentError) { scheduler.trap(:FOO) { } }
+  end
+end
@@ -65,4 +65,138 @@ class TestFiberSleep < MiniTest::Test
     thread.join
     assert finished
   end
+
+  def test_kill_stops_sleep_timer
+    killed = false
+    t0 = Time.now
+    thread = Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      f = Fiber.schedule do
+        sleep 5
+      ensure
+        killed = true
+      end
+      Fiber.schedule { f.kill }
+    end
+
+    thread.join
+    assert killed
+    assert_operator Time.now - t0, :<, 1
+  end
+
+  def test_raise_delivered_on_resume
+    order = []
+    error = nil
+    thread = Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      f = Fiber.schedule do
+        sleep 5
+      rescue => e
+        order << :rescued
+        error = e
+      end
+      Fiber.schedule do
+        f.raise(ArgumentError, 'foo')
+        order << :raised
+      end
+    end
+
+    thread.join
+    assert_equal [:raised, :rescued], order
+    assert_kind_of ArgumentError, error
+    assert_equal 'foo', error.message
+  end
+
+  def test_raise_after_timer_fired
+    slept = nil
+    thread = Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      f = nil
+      # both timers fire in the same iteration, so the raising fiber runs
+      # while f is already queued by its timer
+      Fiber.schedule do
+        sleep 0.01
+        f.raise 'foo'
+      end
+      f = Fiber.schedule do
+        sleep 0.01
+      rescue
+        t0 = Time.now
+        sleep 0.05
+        slept = Time.now - t0
+      end
+    end
+
+    thread.join
+    assert_operator slept, :>=, 0.04
+  end
+
+  def test_sleep_zero_yields
+    finished = false
+    iterations = 0
+
+    thread = Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        until finished
+          iterations += 1
+          sleep 0
+        end
+      end
+
+      Fiber.schedule do
+        sleep 0.05
+        finished = true
+      end
+    end
+
+    thread.join
+    assert finished
+    assert_operator iterations, :>, 1
+  end
+
+  def test_scheduler_yield
+    items = []
+
+    thread = Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      2.times do |i|
+        Fiber.schedule do
+          3.times do |j|
+            items << [i, j]
+            scheduler.yield
+          end
+        end
+      end
+    end
+
+    thread.join
+    assert_equal [[0, 0], [1, 0], [0, 1], [1, 1], [0, 2], [1, 2]], items
+  end
+
+  def test_yield_polls_each_pass
+    polls = nil
+
+    thread = Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        scheduler.reset_latency_stats
+        100.times { scheduler.yield }
+        polls = scheduler.latency_stats[:poll][:count]
+      end
+    end
+
+    thread.join
+    # I/O and timers are checked between yields, not only every so often
+    assert_operator polls, :>=, 100
+  end
 end
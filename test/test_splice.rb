@@ -0,0 +1,129 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+require 'socket'
+
+class TestSplice < MiniTest::Test
+  def setup
+    skip 'splice not supported' unless Libev::Scheduler.method_defined?(:splice)
+  end
+
+  def test_splice
+    i1, o1 = IO.pipe
+    i2, o2 = UNIXSocket.pair
+    moved = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        while (len = scheduler.splice(i1, o2, 4)) > 0
+          moved << len
+        end
+        o2.close
+      end
+
+      Fiber.schedule do
+        o1 << 'foobar'
+        sleep 0.01
+        o1 << 'baz'
+        o1.close
+      end
+    end.join
+
+    assert_equal [4, 2, 3], moved
+    assert_equal 'foobarbaz', i2.read
+  end
+
+  def test_sendfile
+    r, w = UNIXSocket.pair
+    sent = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        File.open(__FILE__) do |f|
+          sent = scheduler.sendfile(f, w, 10, 20)
+        end
+        w.close
+      end
+    end.join
+
+    assert_equal 20, sent
+    assert_equal IO.read(__FILE__)[10, 20], r.read
+  end
+
+  def test_proxy
+    client, a = UNIXSocket.pair
+    b, server = UNIXSocket.pair
+    result = nil
+    server_received = nil
+    client_received = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        result = scheduler.proxy(a, b)
+      end
+
+      Fiber.schedule do
+        client << 'request'
+        client.close_write
+        client_received = client.read
+      end
+
+      Fiber.schedule do
+        server_received = server.read
+        server << 'response!'
+        server.close_write
+      end
+    end.join
+
+    assert_equal 'request', server_received
+    assert_equal 'response!', client_received
+    assert_equal [7, 9], result
+  end
+
+  def test_proxy_error
+    client, a = UNIXSocket.pair
+    b, server = UNIXSocket.pair
+    server.close_read # writes to b fail with EPIPE
+    error = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        scheduler.proxy(a, b)
+      rescue => e
+        error = e
+      end
+
+      Fiber.schedule do
+        client << 'request'
+      end
+    end.join
+
+    # the other direction (waiting to read from b) is cancelled
+    assert_kind_of Errno::EPIPE, error
+  end
+
+  def test_splice_zero_maxlen
+    i, o = IO.pipe
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        assert_raises(ArgumentError) { scheduler.splice(i, o, 0) }
+      end
+    end.join
+  end
+end
@@ -0,0 +1,81 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestStallDetector < MiniTest::Test
+  def test_detects_stall
+    scheduler = nil
+    reported = []
+    blocking_fiber = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      scheduler.detect_stalls(threshold: 0.05) { |stall| reported << stall }
+
+      blocking_fiber = Fiber.schedule do
+        t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        nil while Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0 < 0.3
+      end
+    end.join
+
+    stalls = scheduler.stalls
+    assert_equal 1, stalls.size
+    assert_equal stalls, reported
+    stall = stalls.first
+    assert_equal blocking_fiber, stall.fiber
+    assert_operator stall.duration, :>=, 0.05
+    assert stall.backtrace.any? { |l| l =~ /test_stall_detector/ }
+  ensure
+    scheduler&.stall_detector&.stop
+  end
+
+  def test_detects_stall_in_c_call_holding_gvl
+    scheduler = nil
+    array = (1..2_000_000).to_a.shuffle
+    sort_time = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      scheduler.detect_stalls(threshold: 0.05)
+
+      Fiber.schedule do
+        t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        array.sort # does not release the GVL or check for interrupts
+        sort_time = Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+      end
+      sleep 0.05
+    end.join
+    sleep 0.05 # let the reporter finalize the duration
+
+    skip 'sort too fast to stall' if sort_time < 0.2
+    stalls = scheduler.stalls
+    assert_equal 1, stalls.size
+    assert_in_range (sort_time * 0.5)..(sort_time + 0.2), stalls.first.duration
+  ensure
+    scheduler&.stall_detector&.stop
+  end
+
+  def test_no_stall_while_polling
+    scheduler = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      scheduler.detect_stalls(threshold: 0.05)
+
+      Fiber.schedule { sleep 0.3 }
+    end.join
+
+    assert_equal [], scheduler.stalls
+  ensure
+    scheduler&.stall_detector&.stop
+  end
+
+  def assert_in_range exp_range, act
+    msg = message(msg) { "Expected #{mu_pp(act)} to be in range #{mu_pp(exp_range)}" }
+    assert exp_range.include?(act), msg
+  end
+end
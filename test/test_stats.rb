@@ -0,0 +1,141 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestLatencyStats < MiniTest::Test
+  def test_latency_stats
+    scheduler = nil
+    thread = Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      10.times do
+        Fiber.schedule do
+          sleep 0.01
+        end
+      end
+    end
+    thread.join
+
+    stats = scheduler.latency_stats
+    assert_equal [:wakeup, :poll, :timer_lateness], stats.keys
+    assert_operator stats[:wakeup][:count], :>=, 20
+    assert_operator stats[:poll][:count], :>=, 1
+    assert_equal 10, stats[:timer_lateness][:count]
+
+    wakeup = stats[:wakeup]
+    assert_operator wakeup[:min], :<=, wakeup[:p50]
+    assert_operator wakeup[:p50], :<=, wakeup[:p99]
+    assert_operator wakeup[:p99], :<=, wakeup[:max]
+    assert_equal wakeup[:max], scheduler.latency_percentile(:wakeup, 100)
+  end
+
+  def test_reset_latency_stats
+    scheduler = nil
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      Fiber.schedule { sleep 0.01 }
+    end.join
+
+    assert_operator scheduler.latency_stats[:poll][:count], :>, 0
+    scheduler.reset_latency_stats
+    stats = scheduler.latency_stats
+    assert_equal 0, stats[:poll][:count]
+    assert_equal 0, stats[:wakeup][:count]
+    assert_equal 0.0, scheduler.latency_percentile(:poll, 99)
+
+    assert_raises(ArgumentError) { scheduler.latency_percentile(:foo, 50) }
+  end
+end
+
+class TestAllocatorStats < MiniTest::Test
+  def test_allocator_stats
+    before = Libev::Scheduler.allocator_stats
+    pipes = 100.times.map { IO.pipe }
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      pipes.each do |i, o|
+        Fiber.schedule { i.read }
+        Fiber.schedule { o << 'foo'; o.close }
+      end
+    end.join
+
+    stats = Libev::Scheduler.allocator_stats
+    assert_equal [:allocated, :peak, :blocks, :hugepage_mapped, :reallocs], stats.keys
+    assert_operator stats[:reallocs], :>, before[:reallocs]
+    assert_operator stats[:peak], :>=, stats[:allocated]
+  ensure
+    pipes&.each { |i, o| i.close; o.close unless o.closed? }
+  end
+
+  def test_hugepages
+    Libev::Scheduler.hugepages = true
+    assert Libev::Scheduler.hugepages?
+
+    before = Libev::Scheduler.allocator_stats[:hugepage_mapped]
+    mapped = nil
+    Thread.new do
+      # the fd table for 200K fds is over 2MB
+      scheduler = Libev::Scheduler.new(expected_fds: 200_000)
+      Fiber.set_scheduler scheduler
+      mapped = Libev::Scheduler.allocator_stats[:hugepage_mapped]
+      Fiber.schedule { sleep 0 }
+    end.join
+
+    assert_operator mapped, :>=, before + 2 * 1024 * 1024
+  ensure
+    Libev::Scheduler.hugepages = false
+  end
+end
+
+class TestCapacityHints < MiniTest::Test
+  def test_expected_capacity
+    before = Libev::Scheduler.allocator_stats[:allocated]
+    scheduler = nil
+    reserved = nil
+    shrunk = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new(expected_fds: 10_000, expected_timers: 10_000)
+      reserved = Libev::Scheduler.allocator_stats[:allocated] - before
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        sleep 0.01
+        scheduler.shrink
+        shrunk = Libev::Scheduler.allocator_stats[:allocated] - before
+        sleep 0.01
+      end
+    end.join
+
+    assert_operator reserved, :>=, 10_000 * 16
+    assert_operator shrunk, :<, reserved / 4
+  end
+
+  def test_shrink_with_active_fds
+    i, o = IO.pipe
+    received = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new(expected_fds: 1000)
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule { received = i.read }
+      Fiber.schedule do
+        scheduler.shrink
+        o << 'foo'
+        sleep 0.01
+        scheduler.shrink
+        o << 'bar'
+        o.close
+      end
+    end.join
+
+    assert_equal 'foobar', received
+  end
+end
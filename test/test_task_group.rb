@@ -0,0 +1,187 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestTaskGroup < MiniTest::Test
+  def test_results_in_spawn_order
+    results = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        results = scheduler.group do |g|
+          g.spawn { sleep 0.03; :a }
+          g.spawn { sleep 0.01; :b }
+          g.spawn { :c }
+        end
+      end
+    end.join
+
+    assert_equal [:a, :b, :c], results
+  end
+
+  def test_spawned_fibers_start_together
+    order = []
+    count = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        scheduler.group do |g|
+          100.times { |i| g.spawn { order << i } }
+          order << :spawned
+          count = g.size
+        end
+      end
+    end.join
+
+    assert_equal 100, count
+    assert_equal [:spawned] + (0...100).to_a, order
+  end
+
+  def test_concurrent
+    t0 = Time.now
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        scheduler.group do |g|
+          10.times { g.spawn { sleep 0.05 } }
+        end
+      end
+    end.join
+
+    assert_in_range 0.04..0.3, Time.now - t0
+  end
+
+  def test_first_exception_propagated
+    error = nil
+    finished = []
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        scheduler.group do |g|
+          g.spawn { sleep 0.02; finished << 0 }
+          g.spawn { sleep 0.01; raise 'foo' }
+          g.spawn { raise 'bar' }
+        end
+      rescue => e
+        error = e
+      end
+    end.join
+
+    assert_kind_of RuntimeError, error
+    assert_equal 'bar', error.message
+    # siblings already running are waited for
+    assert_equal [0], finished
+  end
+
+  def test_group_from_blocking_fiber
+    results = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      results = scheduler.group do |g|
+        3.times { |i| g.spawn { sleep 0.01; i * 2 } }
+      end
+    end.join
+
+    assert_equal [0, 2, 4], results
+  end
+
+  def test_spawn_after_close
+    group = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        scheduler.group { |g| group = g }
+      end
+    end.join
+
+    assert_raises(RuntimeError) { group.spawn { } }
+  end
+
+  def test_joiner_interrupted
+    errors = []
+    group = nil
+    t0 = Time.now
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      joiner = Fiber.schedule do
+        scheduler.group do |g|
+          group = g
+          2.times do
+            g.spawn do
+              sleep 1
+            rescue => e
+              errors << e
+              sleep 0.01 # still waited for
+              raise
+            end
+          end
+        end
+      rescue => e
+        errors << e
+      end
+      Fiber.schedule do
+        sleep 0.02
+        joiner.raise(RuntimeError, 'interrupted')
+      end
+    end.join
+
+    assert_in_range 0.02..0.5, Time.now - t0
+    assert_equal 3, errors.size
+    assert_equal ['interrupted'], errors.map(&:message).uniq
+    assert_raises(RuntimeError) { group.spawn { } }
+  end
+
+  def test_cancel_scope
+    started = []
+    result = :none
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        result = Libev::CancelScope.new(0.02).run do
+          scheduler.group do |g|
+            g.spawn { started << 0; sleep 1 }
+            g.spawn do
+              started << 1
+              sleep 1
+            ensure
+              g.spawn { started << 2 } # not started once cancelled
+            end
+          end
+        end
+      end
+    end.join
+
+    assert_nil result
+    assert_equal [0, 1], started
+  end
+
+  def assert_in_range exp_range, act
+    msg = message(msg) { "Expected #{mu_pp(act)} to be in range #{mu_pp(exp_range)}" }
+    assert exp_range.include?(act), msg
+  end
+end
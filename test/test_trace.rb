@@ -0,0 +1,79 @@
+# frozen_string_literal: true
+require 'bundler/setup'
+require 'minitest/autorun'
+require 'libev_scheduler'
+
+class TestTrace < MiniTest::Test
+  def test_trace_events
+    scheduler = nil
+    data = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      scheduler.start_tracing(16)
+      assert scheduler.tracing?
+
+      i, o = IO.pipe
+      Fiber.schedule do
+        i.read(5)
+      end
+      Fiber.schedule do
+        sleep 0.01
+        o.write('hello')
+      end
+      scheduler.run
+      data = scheduler.stop_tracing
+    end.join
+
+    refute scheduler.tracing?
+    events = Libev::Trace.events(data)
+    types = events.map { |e| e[2] }
+    %i[fiber_resume fiber_yield io_wait_start io_wait_end timer_start timer_fire poll_enter poll_exit unblock].each do |type|
+      assert_includes types, type
+    end
+
+    times = events.map(&:first)
+    assert_equal times.sort, times
+
+    chrome = Libev::Trace.to_chrome(data)
+    assert_kind_of Array, chrome[:traceEvents]
+    assert chrome[:traceEvents].any? { |e| e[:name] == 'io_wait' && e[:ph] == 'b' }
+    JSON.parse(Libev::Trace.to_chrome_json(data))
+  end
+
+  def test_dropped_events
+    scheduler = nil
+    dropped = nil
+    data = nil
+
+    Thread.new do
+      scheduler = Libev::Scheduler.new
+      Fiber.set_scheduler scheduler
+      scheduler.start_tracing(8, 10 * Libev::Trace::EVENT_SIZE)
+      assert_equal 0, scheduler.trace_dropped
+
+      # more events than fit in the buffer between two polls
+      100.times { Fiber.schedule { sleep 0.001 } }
+      scheduler.run
+      dropped = scheduler.trace_dropped
+      data = scheduler.stop_tracing
+    end.join
+
+    assert_nil scheduler.trace_dropped
+    assert_operator data.bytesize, :<=, 10 * Libev::Trace::EVENT_SIZE
+    assert_operator dropped, :>, 0
+    assert_equal data.bytesize / Libev::Trace::EVENT_SIZE, Libev::Trace.events(data).size
+  end
+
+  def test_flush_trace
+    scheduler = Libev::Scheduler.new
+    assert_nil scheduler.flush_trace
+
+    scheduler.start_tracing
+    data = scheduler.flush_trace
+    assert_equal '', data
+    assert_equal Encoding::BINARY, data.encoding
+    scheduler.stop_tracing
+  end
+end